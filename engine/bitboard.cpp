@@ -1,35 +1,152 @@
 #include "bitboard.hpp"
+#ifdef HCE
+#include "psqt.hpp"
+#endif
 #include <cctype>
-#include <random>
 
-uint64_t zobrist_square[64][15];
-uint64_t zobrist_castling[16];
-uint64_t zobrist_ep[9];
-uint64_t zobrist_side;
+// std::mt19937_64 as a literal type, so that the Zobrist keys can be drawn at compile time
+class Mt19937_64 {
+private:
+	uint64_t mt[312];
+	int idx;
 
-__attribute__((constructor)) void init_zobrist() {
-	std::mt19937_64 rng(0xdeadbeef);
-	std::uniform_int_distribution<uint64_t> dist;
+public:
+	constexpr Mt19937_64(uint64_t seed) : mt(), idx(312) {
+		mt[0] = seed;
+		for (int i = 1; i < 312; i++)
+			mt[i] = 6364136223846793005ULL * (mt[i - 1] ^ (mt[i - 1] >> 62)) + i;
+	}
 
-	for (int i = 0; i < 64; i++) {
-		for (int j = 0; j < 14; j++) {
-			zobrist_square[i][j] = dist(rng);
+	constexpr uint64_t operator()() {
+		if (idx == 312) {
+			for (int i = 0; i < 312; i++) {
+				uint64_t x = (mt[i] & 0xffffffff80000000ULL) | (mt[(i + 1) % 312] & 0x7fffffffULL);
+				mt[i] = mt[(i + 156) % 312] ^ (x >> 1) ^ ((x & 1) ? 0xb5026f5aa96619e9ULL : 0);
+			}
+			idx = 0;
 		}
-		zobrist_square[i][14] = 0;
+		uint64_t y = mt[idx++];
+		y ^= (y >> 29) & 0x5555555555555555ULL;
+		y ^= (y << 17) & 0x71d67fffeda60000ULL;
+		y ^= (y << 37) & 0xfff7eee000000000ULL;
+		return y ^ (y >> 43);
 	}
+};
 
-	for (int i = 0; i < 16; i++) {
-		zobrist_castling[i] = dist(rng);
-	}
+struct ZobristKeys {
+	uint64_t square[64][15];
+	uint64_t castling[16];
+	uint64_t ep[9];
+	uint64_t side;
+
+	constexpr ZobristKeys() : square(), castling(), ep(), side(0) {
+		Mt19937_64 rng(0xdeadbeef);
+		for (int i = 0; i < 64; i++) {
+			for (int j = 0; j < 14; j++) {
+				square[i][j] = rng();
+			}
+			square[i][14] = 0;
+		}
+
+		for (int i = 0; i < 16; i++) {
+			castling[i] = rng();
+		}
 
-	for (int i = 0; i < 8; i++) {
-		zobrist_ep[i] = dist(rng);
+		for (int i = 0; i < 8; i++) {
+			ep[i] = rng();
+		}
+		ep[8] = 0;
+
+		side = rng();
 	}
-	zobrist_ep[8] = 0;
+};
+
+constexpr ZobristKeys ZOBRIST_KEYS;
+constexpr const uint64_t (&zobrist_square)[64][15] = ZOBRIST_KEYS.square;
+constexpr const uint64_t (&zobrist_castling)[16] = ZOBRIST_KEYS.castling;
+constexpr const uint64_t (&zobrist_ep)[9] = ZOBRIST_KEYS.ep;
+constexpr uint64_t zobrist_side = ZOBRIST_KEYS.side;
 
-	zobrist_side = dist(rng);
+// Squares strictly between a and b, if they are on a common line
+static constexpr Bitboard squares_between(int a, int b) {
+	int dr = (b >> 3) - (a >> 3), df = (b & 7) - (a & 7);
+	if (dr != 0 && df != 0 && dr != df && dr != -df)
+		return 0;
+	int step = (dr > 0) - (dr < 0);
+	step = step * 8 + (df > 0) - (df < 0);
+	Bitboard res = 0;
+	for (int sq = a + step; sq != b; sq += step)
+		res |= square_bits(Square(sq));
+	return res;
 }
 
+// Whether a piece of type pt on a attacks b on an empty board
+static constexpr bool empty_board_attack(int pt, int a, int b) {
+	int dr = (b >> 3) - (a >> 3), df = (b & 7) - (a & 7);
+	dr = dr < 0 ? -dr : dr;
+	df = df < 0 ? -df : df;
+	switch (pt) {
+	case KNIGHT:
+		return dr * df == 2;
+	case BISHOP:
+		return dr == df && dr;
+	case ROOK:
+		return (dr == 0) != (df == 0);
+	case QUEEN:
+		return (dr == df && dr) || ((dr == 0) != (df == 0));
+	case KING:
+		return std::max(dr, df) == 1;
+	}
+	return false;
+}
+
+/**
+ * Cuckoo tables of reversible moves, for upcoming_repetition.
+ *
+ * Every move of a non-pawn piece between two squares it attacks on an empty board changes the
+ * hash by a fixed amount (the two square keys and the side key). The 3668 such moves are stored
+ * by that amount, each in one of two slots given by CUCKOO_H1 and CUCKOO_H2.
+ */
+#define CUCKOO_SIZE 8192
+#define CUCKOO_H1(key) ((key) & (CUCKOO_SIZE - 1))
+#define CUCKOO_H2(key) (((key) >> 16) & (CUCKOO_SIZE - 1))
+
+struct CuckooTables {
+	uint64_t keys[CUCKOO_SIZE];
+	Move moves[CUCKOO_SIZE];
+
+	constexpr CuckooTables() : keys(), moves() {
+		for (int pt = KNIGHT; pt <= KING; pt++) {
+			for (int color = 0; color < 2; color++) {
+				Piece piece = Piece(pt + (color << 3));
+				for (int a = 0; a < 64; a++) {
+					for (int b = a + 1; b < 64; b++) {
+						if (!empty_board_attack(pt, a, b))
+							continue;
+						Move move(a, b);
+						uint64_t key = zobrist_square[a][piece] ^ zobrist_square[b][piece] ^ zobrist_side;
+						// Insert, kicking out whatever is in the way to its other slot until a slot is free
+						uint64_t i = CUCKOO_H1(key);
+						while (true) {
+							uint64_t old_key = keys[i];
+							Move old_move = moves[i];
+							keys[i] = key;
+							moves[i] = move;
+							key = old_key;
+							move = old_move;
+							if (move == NullMove)
+								break;
+							i = i == CUCKOO_H1(key) ? CUCKOO_H2(key) : CUCKOO_H1(key);
+						}
+					}
+				}
+			}
+		}
+	}
+};
+
+constexpr CuckooTables CUCKOO;
+
 void print_bitboard(Bitboard board) {
 	for (int i = 7; i >= 0; i--) {
 		for (int j = 0; j < 8; j++) {
@@ -106,6 +223,7 @@ void Board::load_fen(std::string fen) {
 	memset(piece_boards, 0, sizeof(piece_boards));
 	memset(mailbox, NO_PIECE, sizeof(mailbox));
 	castling = NO_CASTLE;
+	states.clear();
 	uint16_t rank = RANK_8;
 	uint16_t file = FILE_A;
 	int inputIdx = 0;
@@ -176,8 +294,16 @@ void Board::load_fen(std::string fen) {
 
 	// Ignore the rest (who cares anyways)
 
-	// Recompute hash
+	// Recompute hash and material
 	recompute_hash();
+	recompute_material();
+
+	// Start a fresh line of accumulators, while the Finny table holds for any position and is kept.
+	// Only the entry of the new position can pass for part of the line: make_move rewrites every
+	// later one before it is used
+	acc_ply = 0;
+	if (AccumulatorState *acc = accumulators.get())
+		acc->stack[0].computed[WHITE] = acc->stack[0].computed[BLACK] = false;
 }
 
 std::string Board::get_fen() const {
@@ -366,6 +492,46 @@ void Board::print_board() const {
 #endif
 }
 
+#ifdef HCE
+// Add (sign 1) or take back (sign -1) the piece-square change of a move
+static inline void update_psqt(Value *psqt, const BoardDelta &delta, int sign) {
+	for (int i = 0; i < delta.nadd; i++) {
+		psqt[MG] += sign * PSQT.table[MG][delta.add_piece[i]][delta.add_sq[i]];
+		psqt[EG] += sign * PSQT.table[EG][delta.add_piece[i]][delta.add_sq[i]];
+	}
+	for (int i = 0; i < delta.nsub; i++) {
+		psqt[MG] -= sign * PSQT.table[MG][delta.sub_piece[i]][delta.sub_sq[i]];
+		psqt[EG] -= sign * PSQT.table[EG][delta.sub_piece[i]][delta.sub_sq[i]];
+	}
+}
+#endif
+
+#ifndef HCE
+// Start loading the weight rows the evaluation will need for a move, while the search gets to it
+static inline void prefetch_delta(const Bitboard *piece_boards, const BoardDelta &delta) {
+	with_network([&](const auto &net) {
+		using Arch = typename std::decay_t<decltype(net)>::Arch;
+		Square ksq[2] = {SQ_A1, SQ_A1};
+		if constexpr (Arch::KING_BUCKETS > 1) {
+			ksq[WHITE] = (Square)_tzcnt_u64(piece_boards[KING] & piece_boards[OCC(WHITE)]);
+			ksq[BLACK] = (Square)_tzcnt_u64(piece_boards[KING] & piece_boards[OCC(BLACK)]);
+			if (ksq[WHITE] == 64 || ksq[BLACK] == 64)
+				return;
+		}
+		for (int i = 0; i < delta.nadd; i++) {
+			Piece piece = delta.add_piece[i];
+			accumulator_prefetch(Arch::feature_index(delta.add_sq[i], PieceType(piece & 7), piece >> 3, 0, ksq[WHITE]));
+			accumulator_prefetch(Arch::feature_index(delta.add_sq[i], PieceType(piece & 7), piece >> 3, 1, ksq[BLACK]));
+		}
+		for (int i = 0; i < delta.nsub; i++) {
+			Piece piece = delta.sub_piece[i];
+			accumulator_prefetch(Arch::feature_index(delta.sub_sq[i], PieceType(piece & 7), piece >> 3, 0, ksq[WHITE]));
+			accumulator_prefetch(Arch::feature_index(delta.sub_sq[i], PieceType(piece & 7), piece >> 3, 1, ksq[BLACK]));
+		}
+	});
+}
+#endif
+
 void Board::make_move(Move move) {
 #ifdef SANCHECK
 	char before[64];
@@ -381,9 +547,22 @@ void Board::make_move(Move move) {
 	}
 #endif
 
-	// Add move to move history
-	move_hist.push(HistoryEntry(move, mailbox[move.dst()], castling, ep_square));
-	halfmove_hist.push(halfmove);
+	acc_ply++;
+#ifdef HCE
+	update_psqt(psqt, move_delta(move), 1);
+#else
+	// Push the move's delta for the evaluation to pick up when (and if) it needs it
+	if (AccumulatorState *acc = accumulators.get()) {
+		AccumulatorEntry &acc_entry = acc->stack[acc_ply % ACC_STACK_SIZE];
+		acc_entry.delta = move_delta(move);
+		acc_entry.ply = acc_ply;
+		acc_entry.computed[WHITE] = acc_entry.computed[BLACK] = false;
+		prefetch_delta(piece_boards, acc_entry.delta);
+	}
+#endif
+
+	// Save what unmake_move can't recover
+	states.push_back({zobrist, move, mailbox[move.dst()], castling, ep_square, halfmove});
 	Square tmp_ep_square = SQ_NONE;
 
 	// Handle captures
@@ -393,9 +572,12 @@ void Board::make_move(Move move) {
 		piece_boards[piece] ^= square_bits(move.dst());
 		piece_boards[OPPOCC(side)] ^= square_bits(move.dst());
 		zobrist ^= zobrist_square[move.dst()][mailbox[move.dst()]];
+		material[!side] -= MaterialValue[piece];
+		phase -= PhaseValue[piece];
+		material_key -= material_key_unit(mailbox[move.dst()]);
 
 		if (piece == ROOK) {
-			uint8_t old_castling = castling;
+			// The castling hash is updated once, for all changes, at the end
 			if (move.dst() == SQ_A1)
 				castling &= ~WHITE_OOO;
 			else if (move.dst() == SQ_H1)
@@ -404,7 +586,6 @@ void Board::make_move(Move move) {
 				castling &= ~BLACK_OOO;
 			else if (move.dst() == SQ_H8)
 				castling &= ~BLACK_OO;
-			zobrist ^= zobrist_castling[old_castling] ^ zobrist_castling[castling];
 		}
 
 		halfmove = -1;
@@ -424,6 +605,9 @@ void Board::make_move(Move move) {
 		piece_boards[PAWN] ^= square_bits(move.src());
 		piece_boards[OCC(side)] ^= square_bits(move.src()) | square_bits(move.dst());
 		piece_boards[move.promotion() + KNIGHT] ^= square_bits(move.dst());
+		material[side] += MaterialValue[move.promotion() + KNIGHT] - PawnValue;
+		phase += PhaseValue[move.promotion() + KNIGHT];
+		material_key += material_key_unit(mailbox[move.dst()]) - material_key_unit(Piece(PAWN + ((!!side) << 3)));
 	} else if (move.type() == EN_PASSANT) {
 		// Remove the pawn on the src and the taken pawn, then add the pawn on the dst
 		zobrist ^= zobrist_square[move.src()][mailbox[move.src()]] ^ zobrist_square[move.dst()][mailbox[move.src()]];
@@ -434,6 +618,8 @@ void Board::make_move(Move move) {
 		piece_boards[PAWN] ^= square_bits(move.src()) | square_bits(move.dst()) | square_bits(Rank(move.src() >> 3), File(move.dst() & 0b111));
 		piece_boards[OCC(side)] ^= square_bits(move.src()) | square_bits(move.dst());
 		piece_boards[OPPOCC(side)] ^= square_bits(Rank(move.src() >> 3), File(move.dst() & 0b111));
+		material[!side] -= PawnValue;
+		material_key -= material_key_unit(Piece(PAWN + ((!side) << 3)));
 	} else if (move.type() == CASTLING) {
 		// Calculate where the rook is
 		Bitboard rook_mask;
@@ -528,11 +714,10 @@ void Board::make_move(Move move) {
 	side = !side;
 	zobrist ^= zobrist_side;
 	// Update castling rights
-	zobrist ^= zobrist_castling[castling] ^ zobrist_castling[move_hist.top().prev_castling()];
+	zobrist ^= zobrist_castling[castling] ^ zobrist_castling[states.back().castling];
 
 	halfmove++;
 
-	hash_hist.push_back(zobrist);
 
 #ifdef HASHCHECK
 	old_hash = zobrist;
@@ -580,43 +765,46 @@ void Board::unmake_move() {
 	}
 #endif
 
-	hash_hist.pop_back();
+	acc_ply--;
 
 	// Switch sides first
 	side = !side;
-	zobrist ^= zobrist_side;
 
-	HistoryEntry prev = move_hist.top();
-	move_hist.pop();
-	Move move = prev.move();
+	StateInfo st = states.back();
+	states.pop_back();
+	Move move = st.move;
 	if (move.data == 0) {
 		// Null move, do nothing on the board, but recover metadata
 	} else if (move.type() == PROMOTION) {
 		// Remove the piece on the dst and add the pawn on the src
-		zobrist ^= zobrist_square[move.dst()][mailbox[move.dst()]] ^ zobrist_square[move.dst()][prev.prev_piece()];
 		mailbox[move.src()] = Piece(PAWN + ((!!side) << 3));
-		mailbox[move.dst()] = prev.prev_piece();
-		zobrist ^= zobrist_square[move.src()][mailbox[move.src()]];
+		mailbox[move.dst()] = st.captured;
 		piece_boards[PAWN] ^= square_bits(move.src());
 		piece_boards[OCC(side)] ^= square_bits(move.src()) | square_bits(move.dst());
 		piece_boards[((move.data >> 12) & 0b11) + KNIGHT] ^= square_bits(move.dst());
+		material[side] -= MaterialValue[move.promotion() + KNIGHT] - PawnValue;
+		phase -= PhaseValue[move.promotion() + KNIGHT];
+		material_key -= material_key_unit(Piece(move.promotion() + KNIGHT + ((!!side) << 3))) - material_key_unit(Piece(PAWN + ((!!side) << 3)));
 		// Handle captures
-		if (prev.prev_piece() != NO_PIECE) { // If there was a capture
+		if (st.captured != NO_PIECE) { // If there was a capture
 			// Add whatever piece it was
-			uint8_t piece = prev.prev_piece() & 0b111;
+			uint8_t piece = st.captured & 0b111;
 			piece_boards[piece] ^= square_bits(move.dst());
 			piece_boards[OPPOCC(side)] ^= square_bits(move.dst());
+			material[!side] += MaterialValue[piece];
+			phase += PhaseValue[piece];
+			material_key += material_key_unit(st.captured);
 		}
 	} else if (move.type() == EN_PASSANT) {
 		// Remove the pawn on the dst and add the pawn on the src and the taken pawn
-		zobrist ^= zobrist_square[move.dst()][mailbox[move.dst()]] ^ zobrist_square[move.src()][mailbox[move.dst()]];
 		mailbox[move.src()] = mailbox[move.dst()];
 		mailbox[move.dst()] = NO_PIECE;
 		mailbox[(move.src() & 0b111000) | (move.dst() & 0b111)] = Piece(WHITE_PAWN + ((!side) << 3));
-		zobrist ^= zobrist_square[(move.src() & 0b111000) | (move.dst() & 0b111)][mailbox[(move.src() & 0b111000) | (move.dst() & 0b111)]]; // Taken pawn
 		piece_boards[PAWN] ^= square_bits(move.src()) | square_bits(move.dst()) | square_bits(Rank(move.src() >> 3), File(move.dst() & 0b111));
 		piece_boards[OCC(side)] ^= square_bits(move.src()) | square_bits(move.dst());
 		piece_boards[OPPOCC(side)] ^= square_bits(Rank(move.src() >> 3), File(move.dst() & 0b111));
+		material[!side] += PawnValue;
+		material_key += material_key_unit(Piece(PAWN + ((!side) << 3)));
 	} else if (move.type() == CASTLING) {
 		if (move.data == 0b1100000100000110) {
 			// White O-O
@@ -627,8 +815,6 @@ void Board::unmake_move() {
 			piece_boards[OCC(WHITE)] ^= square_bits(SQ_E1) | square_bits(SQ_G1) | square_bits(SQ_H1) | square_bits(SQ_F1);
 			piece_boards[KING] ^= square_bits(SQ_E1) | square_bits(SQ_G1);
 			piece_boards[ROOK] ^= square_bits(SQ_H1) | square_bits(SQ_F1);
-			zobrist ^= zobrist_square[SQ_E1][Piece(WHITE_KING)] ^ zobrist_square[SQ_G1][Piece(WHITE_KING)];
-			zobrist ^= zobrist_square[SQ_H1][Piece(WHITE_ROOK)] ^ zobrist_square[SQ_F1][Piece(WHITE_ROOK)];
 		} else if (move.data == 0b1100000100000010) {
 			// White O-O-O
 			mailbox[SQ_C1] = NO_PIECE;
@@ -638,8 +824,6 @@ void Board::unmake_move() {
 			piece_boards[OCC(WHITE)] ^= square_bits(SQ_E1) | square_bits(SQ_C1) | square_bits(SQ_A1) | square_bits(SQ_D1);
 			piece_boards[KING] ^= square_bits(SQ_E1) | square_bits(SQ_C1);
 			piece_boards[ROOK] ^= square_bits(SQ_A1) | square_bits(SQ_D1);
-			zobrist ^= zobrist_square[SQ_E1][Piece(WHITE_KING)] ^ zobrist_square[SQ_C1][Piece(WHITE_KING)];
-			zobrist ^= zobrist_square[SQ_A1][Piece(WHITE_ROOK)] ^ zobrist_square[SQ_D1][Piece(WHITE_ROOK)];
 		} else if (move.data == 0b1100111100111110) {
 			// Black O-O
 			mailbox[SQ_G8] = NO_PIECE;
@@ -649,8 +833,6 @@ void Board::unmake_move() {
 			piece_boards[OCC(BLACK)] ^= square_bits(SQ_E8) | square_bits(SQ_G8) | square_bits(SQ_H8) | square_bits(SQ_F8);
 			piece_boards[KING] ^= square_bits(SQ_E8) | square_bits(SQ_G8);
 			piece_boards[ROOK] ^= square_bits(SQ_H8) | square_bits(SQ_F8);
-			zobrist ^= zobrist_square[SQ_E8][Piece(BLACK_KING)] ^ zobrist_square[SQ_G8][Piece(BLACK_KING)];
-			zobrist ^= zobrist_square[SQ_H8][Piece(BLACK_ROOK)] ^ zobrist_square[SQ_F8][Piece(BLACK_ROOK)];
 		} else if (move.data == 0b1100111100111010) {
 			// Black O-O-O
 			mailbox[SQ_C8] = NO_PIECE;
@@ -660,8 +842,6 @@ void Board::unmake_move() {
 			piece_boards[OCC(BLACK)] ^= square_bits(SQ_E8) | square_bits(SQ_C8) | square_bits(SQ_A8) | square_bits(SQ_D8);
 			piece_boards[KING] ^= square_bits(SQ_E8) | square_bits(SQ_C8);
 			piece_boards[ROOK] ^= square_bits(SQ_A8) | square_bits(SQ_D8);
-			zobrist ^= zobrist_square[SQ_E8][Piece(BLACK_KING)] ^ zobrist_square[SQ_C8][Piece(BLACK_KING)];
-			zobrist ^= zobrist_square[SQ_A8][Piece(BLACK_ROOK)] ^ zobrist_square[SQ_D8][Piece(BLACK_ROOK)];
 		} else {
 			std::cerr << "Il faut que tu meures" << std::endl;
 			volatile int *p = 0;
@@ -671,35 +851,33 @@ void Board::unmake_move() {
 		// Get piece that is moving
 		uint8_t piece = mailbox[move.dst()] & 0b111;
 		// Update mailbox repr first
-		zobrist ^= zobrist_square[move.dst()][mailbox[move.dst()]] ^ zobrist_square[move.src()][mailbox[move.dst()]];
-		zobrist ^= zobrist_square[move.dst()][prev.prev_piece()];
 		mailbox[move.src()] = mailbox[move.dst()];
-		mailbox[move.dst()] = prev.prev_piece();
+		mailbox[move.dst()] = st.captured;
 		// Update piece and occupancy bitboard
 		piece_boards[piece] ^= square_bits(move.src()) | square_bits(move.dst());
 		piece_boards[OCC(side)] ^= square_bits(move.src()) | square_bits(move.dst());
 		// Handle captures
-		if (prev.prev_piece() != NO_PIECE) { // If there was a capture
+		if (st.captured != NO_PIECE) { // If there was a capture
 			// Add whatever piece it was
-			piece = prev.prev_piece() & 0b111;
+			piece = st.captured & 0b111;
 			piece_boards[piece] ^= square_bits(move.dst());
 			piece_boards[OPPOCC(side)] ^= square_bits(move.dst());
+			material[!side] += MaterialValue[piece];
+			phase += PhaseValue[piece];
+			material_key += material_key_unit(st.captured);
 		}
 	}
 
-	// Update EP square
-	if (ep_square != SQ_NONE)
-		zobrist ^= zobrist_ep[ep_square & 0b111];
-	if (prev.prev_ep() != SQ_NONE)
-		zobrist ^= zobrist_ep[prev.prev_ep() & 0b111];
-	ep_square = prev.prev_ep();
-	// Update castling rights
-	int old_castling = castling;
-	zobrist ^= zobrist_castling[castling] ^ zobrist_castling[prev.prev_castling()];
-	castling = prev.prev_castling();
+	// Restore the state the move overwrote
+	zobrist = st.key;
+	ep_square = st.ep_square;
+	castling = st.castling;
+	halfmove = st.halfmove;
 
-	halfmove = halfmove_hist.top();
-	halfmove_hist.pop();
+#ifdef HCE
+	// The board is back to the position the move was made from, so its delta is the same as in make_move
+	update_psqt(psqt, move_delta(move), -1);
+#endif
 
 #ifdef HASHCHECK
 	old_hash = zobrist;
@@ -707,7 +885,7 @@ void Board::unmake_move() {
 	if (zobrist != old_hash) {
 		print_board();
 		std::cerr << "Hash mismatch after unmake: expected " << zobrist << " got " << old_hash << '\n';
-		std::cerr << prev.move().to_string() << std::endl;
+		std::cerr << move.to_string() << std::endl;
 		abort();
 	}
 #endif
@@ -745,12 +923,105 @@ void Board::recompute_hash() {
 	zobrist ^= zobrist_side * side;
 }
 
-bool Board::threefold() {
-	int cnt = 0;
-	for (const uint64_t h : hash_hist) {
-		if (h == zobrist)
-			cnt++;
-		if (cnt >= 3)
+void Board::recompute_material() {
+	material[WHITE] = material[BLACK] = 0;
+	phase = 0;
+	material_key = 0;
+	for (int i = 0; i < 64; i++) {
+		if (mailbox[i] == NO_PIECE)
+			continue;
+		material[mailbox[i] >> 3] += MaterialValue[mailbox[i] & 7];
+		phase += PhaseValue[mailbox[i] & 7];
+		material_key += material_key_unit(mailbox[i]);
+	}
+#ifdef HCE
+	psqt[MG] = psqt[EG] = 0;
+	for (int i = 0; i < 64; i++) {
+		if (mailbox[i] == NO_PIECE)
+			continue;
+		psqt[MG] += PSQT.table[MG][mailbox[i]][i];
+		psqt[EG] += PSQT.table[EG][mailbox[i]][i];
+	}
+#endif
+}
+
+void Board::reset_accumulators() {
+	AccumulatorState *acc = accumulators.get();
+	if (!acc)
+		return;
+	for (AccumulatorEntry &entry : acc->stack)
+		entry.computed[WHITE] = entry.computed[BLACK] = false;
+	for (FinnyEntry &entry : acc->finny_table)
+		entry.valid = false;
+}
+
+BoardDelta Board::move_delta(Move move) const {
+	BoardDelta delta;
+	if (move.data == 0)
+		return delta; // Null move
+	Square src = move.src(), dst = move.dst();
+	Piece piece = mailbox[src];
+	delta.sub(src, piece);
+	if (move.type() == EN_PASSANT) {
+		delta.add(dst, piece);
+		Square taken = Square((src & 0b111000) | (dst & 0b111));
+		delta.sub(taken, mailbox[taken]);
+	} else if (move.type() == CASTLING) {
+		// The king lands on the g- or c-file, and the rook jumps over it
+		bool kingside = (dst & 0b111) == 6;
+		Square rook_src = Square(kingside ? dst + 1 : dst - 2);
+		delta.add(dst, piece);
+		delta.sub(rook_src, mailbox[rook_src]);
+		delta.add(Square(kingside ? dst - 1 : dst + 1), mailbox[rook_src]);
+	} else {
+		delta.add(dst, move.type() == PROMOTION ? Piece((piece & 0b1000) | (move.promotion() + KNIGHT)) : piece);
+		if (mailbox[dst] != NO_PIECE)
+			delta.sub(dst, mailbox[dst]);
+	}
+	return delta;
+}
+
+bool Board::repetition(int ply) const {
+	// Only positions since the last capture or pawn move can repeat, and only every other one has
+	// the same side to move. states[n - i].key is the position i plies ago.
+	int n = states.size();
+	int end = std::min<int>(halfmove, n);
+	int count = 0;
+	for (int i = 2; i <= end; i += 2) {
+		// Positions on the other side of a null move weren't reached by playing moves
+		if (states[n - i + 1].move == NullMove || states[n - i].move == NullMove)
+			break;
+		if (states[n - i].key != zobrist)
+			continue;
+		if (i < ply || ++count == 2)
+			return true;
+	}
+	return false;
+}
+
+bool Board::upcoming_repetition(int ply) const {
+	int n = states.size();
+	int end = std::min<int>(halfmove, n);
+	if (end < 3 || states[n - 1].move == NullMove)
+		return false;
+	Bitboard occ = piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)];
+	// Positions an odd number of plies ago have the other side to move, so one move can reach them
+	for (int i = 3; i <= end; i += 2) {
+		if (states[n - i + 1].move == NullMove || states[n - i].move == NullMove)
+			break;
+		uint64_t diff = zobrist ^ states[n - i].key;
+		int j = CUCKOO_H1(diff);
+		if (CUCKOO.keys[j] != diff) {
+			j = CUCKOO_H2(diff);
+			if (CUCKOO.keys[j] != diff)
+				continue;
+		}
+		// The move is only playable if nothing stands in its way
+		Move move = CUCKOO.moves[j];
+		if (squares_between(move.src(), move.dst()) & occ)
+			continue;
+		// Only claim the draw if the earlier position is on the searched line, like repetition()
+		if (i < ply)
 			return true;
 	}
 	return false;
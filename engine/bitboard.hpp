@@ -2,7 +2,9 @@
 
 #include "includes.hpp"
 #include "move.hpp"
-#include "ttable.hpp"
+#include "nnue/network.hpp"
+
+#include <memory>
 
 // Selects the occupancy array by xoring 6 with side (white: false = 0 ^ 6 = 6, black: true = 1 ^ 6 = 7)
 #define OCC(side) (6 ^ (side))
@@ -26,6 +28,8 @@ constexpr Bitboard Rank6Bits = Rank1Bits << (8 * 5);
 constexpr Bitboard Rank7Bits = Rank1Bits << (8 * 6);
 constexpr Bitboard Rank8Bits = Rank1Bits << (8 * 7);
 
+constexpr Bitboard DarkSquares = 0xaa55aa55aa55aa55ULL;
+
 extern Bitboard pseudoAttacks[6][64];
 
 // clang-format off
@@ -35,40 +39,150 @@ constexpr Bitboard square_bits(Rank r, File f) { return 1ULL << (r * 8 + f); }
 
 void print_bitboard(Bitboard);
 
-// A history entry stores the move and other information needed to unmake it
-// bits 0-15: move
-// bits 16-19: captured piece
-// bits 20-23: previous castling rights
-// bits 24-29: previous en passant square
-struct HistoryEntry {
-	uint32_t data;
-	constexpr explicit HistoryEntry(uint32_t d) : data(d) {}
-	constexpr HistoryEntry(Move m, Piece prev_piece, uint8_t prev_castling, Square prev_ep)
-		: data(m.data | ((uint32_t)prev_piece << 16) | ((uint32_t)prev_castling << 20) | ((uint32_t)prev_ep << 24)) {}
-	constexpr Move move() {
-		return Move(data & 0xffff);
+// A material key holds the number of pieces of each type and color, kings excepted, in 4 bits
+// each (pawns to queens, white then black), so that equal material means an equal key
+constexpr uint64_t material_key_unit(Piece piece) {
+	return piece == NO_PIECE || (piece & 7) == KING ? 0 : 1ULL << (4 * ((piece & 7) + 5 * (piece >> 3)));
+}
+
+// What make_move can't recover from the move itself, saved for unmake_move (16 bytes per ply)
+struct StateInfo {
+	uint64_t key; // Hash of the position before the move
+	Move move;
+	Piece captured; // Piece on the destination square, NO_PIECE for quiet moves and en passant
+	uint8_t castling;
+	Square ep_square;
+	uint8_t halfmove;
+};
+
+// Pieces put on and taken off the board by a move, which is all incremental evaluation needs
+struct BoardDelta {
+	uint8_t nadd = 0, nsub = 0;
+	Square add_sq[2], sub_sq[2];
+	Piece add_piece[2], sub_piece[2];
+
+	void add(Square sq, Piece piece) {
+		add_sq[nadd] = sq;
+		add_piece[nadd++] = piece;
 	}
-	constexpr Piece prev_piece() {
-		return Piece((data >> 16) & 0b1111);
+	void sub(Square sq, Piece piece) {
+		sub_sq[nsub] = sq;
+		sub_piece[nsub++] = piece;
 	}
-	constexpr uint8_t prev_castling() {
-		return (data >> 20) & 0b1111;
+};
+
+// Plies of history a board has room for before its first reallocation
+#define STATE_RESERVE 256
+
+/**
+ * A board's history, one StateInfo per move played.
+ *
+ * A copied vector only has room for the elements it copies, so that the copy's first make_move
+ * would reallocate. Every history keeps room for STATE_RESERVE more plies instead.
+ */
+struct StateHistory : std::vector<StateInfo> {
+	StateHistory() { reserve(STATE_RESERVE); }
+	StateHistory(const StateHistory &o) : std::vector<StateInfo>() { *this = o; }
+	StateHistory(StateHistory &&) = default;
+	StateHistory &operator=(const StateHistory &o) {
+		if (this != &o) {
+			reserve(o.size() + STATE_RESERVE);
+			assign(o.begin(), o.end());
+		}
+		return *this;
 	}
-	constexpr Square prev_ep() {
-		return Square(data >> 24);
+	StateHistory &operator=(StateHistory &&) = default;
+};
+
+// Number of plies kept in the accumulator stack (a ring buffer, so longer lines just refresh)
+#define ACC_STACK_SIZE 128
+
+// NNUE accumulators of a position on the current line, computed lazily by eval
+struct AccumulatorEntry {
+	alignas(NNUE_ALIGN) int16_t storage[2][MAX_HL_SIZE]; // Room for the accumulators of the largest architecture
+	BoardDelta delta; // Change from the previous position
+	uint32_t ply = 0; // Which position on the line this entry currently holds
+	bool computed[2] = {}; // Whether each perspective is up to date
+
+	// The accumulators from white's and black's perspective, for the architecture of the network in use
+	template <typename Arch>
+	Accumulator<Arch> *acc() {
+		static_assert(2 * sizeof(Accumulator<Arch>) <= sizeof(storage));
+		return (Accumulator<Arch> *)storage;
+	}
+
+	template <typename Arch>
+	const Accumulator<Arch> *acc() const {
+		return (const Accumulator<Arch> *)storage;
+	}
+};
+
+/**
+ * Accumulator refresh cache ("Finny table") entry.
+ *
+ * Holds the last accumulator computed from scratch for one perspective and king key (see
+ * NetworkArch::king_key), along with the pieces it was computed for. A king move that needs a
+ * refresh then only has to apply the difference between those pieces and the current ones.
+ */
+struct FinnyEntry {
+	alignas(NNUE_ALIGN) int16_t storage[MAX_HL_SIZE];
+	Bitboard piece_boards[8];
+	bool valid = false;
+
+	template <typename Arch>
+	Accumulator<Arch> &acc() {
+		static_assert(sizeof(Accumulator<Arch>) <= sizeof(storage));
+		return *(Accumulator<Arch> *)storage;
 	}
 };
 
+// Finny table entries per perspective
+#define FINNY_SIZE (2 * MAX_KING_BUCKETS)
+
+// One accumulator entry per position on the current line, and the Finny table
+struct AccumulatorState {
+	AccumulatorEntry stack[ACC_STACK_SIZE];
+	FinnyEntry finny_table[2 * FINNY_SIZE];
+};
+
+/**
+ * A board's accumulators, allocated by the first evaluation that needs them.
+ *
+ * They are only valid for the line of the board that computed them, so a copied board starts
+ * without any and computes its own; this keeps copying a board cheap.
+ */
+class AccumulatorHandle {
+private:
+	std::unique_ptr<AccumulatorState> state;
+
+public:
+	AccumulatorHandle() = default;
+	AccumulatorHandle(const AccumulatorHandle &) {}
+	AccumulatorHandle(AccumulatorHandle &&) = default;
+	AccumulatorHandle &operator=(const AccumulatorHandle &) {
+		state.reset();
+		return *this;
+	}
+	AccumulatorHandle &operator=(AccumulatorHandle &&) = default;
+
+	AccumulatorState *get() const { return state.get(); }
+
+	AccumulatorState &operator*() {
+		if (!state)
+			state.reset(new AccumulatorState());
+		return *state;
+	}
+};
+
+/**
+ * The position and the history needed to unmake its moves.
+ *
+ * The fields used by move generation and make_move come first, so that they share the first
+ * few cache lines. Copying a board copies those and the history of the game (see StateInfo);
+ * the transposition table is global and the accumulators are not copied (see AccumulatorHandle).
+ */
 struct Board {
 	Bitboard piece_boards[8] = {0};
-	bool side = WHITE;
-	uint8_t halfmove = 0;
-	uint8_t castling = 0xf; // 1111
-	Square ep_square = SQ_NONE;
-	uint64_t zobrist = 0;
-	TTable ttable;
-	pzstd::largevector<uint64_t> hash_hist;
-
 	// Mailbox representation of the board for faster queries of certain data
 	Piece mailbox[8 * 8] = {WHITE_ROOK, WHITE_KNIGHT, WHITE_BISHOP, WHITE_QUEEN, WHITE_KING, WHITE_BISHOP, WHITE_KNIGHT, WHITE_ROOK,
 							WHITE_PAWN, WHITE_PAWN,	  WHITE_PAWN,	WHITE_PAWN,	 WHITE_PAWN, WHITE_PAWN,   WHITE_PAWN,	 WHITE_PAWN,
@@ -78,13 +192,26 @@ struct Board {
 							NO_PIECE,	NO_PIECE,	  NO_PIECE,		NO_PIECE,	 NO_PIECE,	 NO_PIECE,	   NO_PIECE,	 NO_PIECE,
 							BLACK_PAWN, BLACK_PAWN,	  BLACK_PAWN,	BLACK_PAWN,	 BLACK_PAWN, BLACK_PAWN,   BLACK_PAWN,	 BLACK_PAWN,
 							BLACK_ROOK, BLACK_KNIGHT, BLACK_BISHOP, BLACK_QUEEN, BLACK_KING, BLACK_BISHOP, BLACK_KNIGHT, BLACK_ROOK};
+	bool side = WHITE;
+	uint8_t halfmove = 0;
+	uint8_t castling = 0xf; // 1111
+	Square ep_square = SQ_NONE;
+	uint64_t zobrist = 0;
+	Value material[2] = {0}; // Sum of MaterialValue over each side's pieces, maintained by make_move
+	uint8_t phase = 0; // Sum of PhaseValue over all pieces, from MAX_PHASE at the start down to 0 with only pawns left
+	uint64_t material_key = 0; // See material_key_unit, maintained by make_move
+#ifdef HCE
+	Value psqt[2] = {0}; // Middlegame and endgame piece-square scores from white's point of view, maintained by make_move
+#endif
+
+	// One entry per move played, pushed by make_move and popped by unmake_move
+	StateHistory states;
 
-	// Moves with extra information (taken piece etc..)
-	// better documentation will be included later
-	std::stack<HistoryEntry> move_hist;
-	std::stack<uint8_t> halfmove_hist;
+	// Accumulators of the positions on the current line, acc_ply is the position's index on it
+	AccumulatorHandle accumulators;
+	uint32_t acc_ply = 0;
 
-	Board(int ttsize=DEFAULT_TT_SIZE) : ttable(ttsize) {
+	Board() {
 		// Load starting position
 		piece_boards[0] = Rank2Bits | Rank7Bits;
 		piece_boards[1] = square_bits(SQ_B1) | square_bits(SQ_G1) | square_bits(SQ_B8) | square_bits(SQ_G8);
@@ -95,11 +222,13 @@ struct Board {
 		piece_boards[6] = Rank1Bits | Rank2Bits;
 		piece_boards[7] = Rank7Bits | Rank8Bits;
 		recompute_hash();
+		recompute_material();
 	}
 
-	Board(std::string fen, int ttsize=DEFAULT_TT_SIZE) : ttable(ttsize) {
+	Board(std::string fen) {
 		load_fen(fen);
 		recompute_hash();
+		recompute_material();
 	};
 
 	void load_fen(std::string);
@@ -109,13 +238,22 @@ struct Board {
 
 	void make_move(Move);
 	void unmake_move();
+	BoardDelta move_delta(Move) const;
 
 	void legal_moves(pzstd::vector<Move> &) const;
 	std::pair<int, int> control(int) const;
+	Bitboard attacks_by(bool) const; // Every square attacked by a side, computed set-wise (see movegen.cpp)
 	Value see(Square);
 	Value see_capture(Move);
 
 	void recompute_hash();
+	void recompute_material();
+	void reset_accumulators(); // Forget every accumulator, including the Finny table (e.g. after switching networks)
 
-	bool threefold();
+	// Whether the position is drawn by repetition: it occurred twice before, or for a search node
+	// `ply` plies from the root, once after the root (the side to move could repeat it again)
+	bool repetition(int ply = 0) const;
+	// Whether the side to move has a reversible move back to a position after the search root,
+	// `ply` plies from it (see the cuckoo tables in bitboard.cpp)
+	bool upcoming_repetition(int ply) const;
 };
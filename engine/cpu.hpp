@@ -0,0 +1,37 @@
+#pragma once
+
+#include "includes.hpp"
+
+/**
+ * CPU features, detected once at startup so that a single binary can run everywhere.
+ *
+ * PEXT exists on every CPU with BMI2, but AMD implemented it in microcode before Zen 3, where
+ * it takes hundreds of cycles. On those CPUs the slider lookups use multiply-shift magics
+ * instead. Building with -DNO_PEXT forces magics everywhere, which is useful for testing.
+ */
+struct CpuFeatures {
+	bool bmi2;
+	bool fast_pext;
+	bool avx2;
+	bool avx512; // AVX-512 F + BW
+	bool vnni; // AVX-512 VNNI
+};
+
+inline CpuFeatures detect_cpu_features() {
+	__builtin_cpu_init();
+	CpuFeatures cpu;
+	cpu.bmi2 = __builtin_cpu_supports("bmi2");
+	cpu.fast_pext = cpu.bmi2 && !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2");
+#ifdef NO_PEXT
+	cpu.fast_pext = false;
+#endif
+	cpu.avx2 = __builtin_cpu_supports("avx2");
+	cpu.avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+	cpu.vnni = cpu.avx512 && __builtin_cpu_supports("avx512vnni");
+	return cpu;
+}
+
+inline const CpuFeatures &cpu_features() {
+	static const CpuFeatures cpu = detect_cpu_features();
+	return cpu;
+}
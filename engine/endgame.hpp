@@ -0,0 +1,117 @@
+#pragma once
+
+#include "bitboard.hpp"
+#include "includes.hpp"
+
+/**
+ * Endgames recognized by their material alone (see material_key_unit).
+ *
+ * - Draws by insufficient material are scored 0 without searching or evaluating them.
+ * - Drawish endings keep their evaluation, scaled down by `scale` / SCALE_NORMAL.
+ * - Trivially won endings are scored by a dedicated evaluator (in eval.cpp), which knows how to
+ *   drive the weak king into a mating corner, instead of the network.
+ *
+ * Every ending is listed once with white as the strong side, and is added for black too.
+ */
+enum EndgameType : uint8_t { ENDGAME_DRAW, ENDGAME_SCALE, ENDGAME_KXK, ENDGAME_KBNK, ENDGAME_KBBK };
+
+#define SCALE_NORMAL 64
+#define SCALE_OPPOSITE_BISHOPS 32 // Bishops of opposite colors with only pawns besides them
+
+// Scores of trivially won endings start here, far above any regular evaluation but below mates
+constexpr Value VALUE_KNOWN_WIN = 5000 * CP_SCALE_FACTOR;
+
+struct Endgame {
+	uint64_t key = 0;
+	EndgameType type = ENDGAME_DRAW;
+	bool strong = WHITE; // The side with the winning chances
+	uint8_t scale = SCALE_NORMAL;
+	bool used = false;
+};
+
+// Material key of an ending written as e.g. "KRvKB", white's pieces first
+constexpr uint64_t endgame_key(const char *code) {
+	constexpr char letters[] = "PNBRQ";
+	uint64_t key = 0;
+	int color = 0;
+	for (; *code; code++) {
+		if (*code == 'v')
+			color = 1;
+		for (int pt = PAWN; pt <= QUEEN; pt++) {
+			if (*code == letters[pt])
+				key += material_key_unit(Piece(pt + (color << 3)));
+		}
+	}
+	return key;
+}
+
+// The same material with the colors swapped
+constexpr uint64_t mirror_key(uint64_t key) {
+	return ((key & 0xfffff) << 20) | (key >> 20);
+}
+
+constexpr uint64_t PAWN_KEY_MASK = material_key_unit(WHITE_PAWN) * 0xf | material_key_unit(BLACK_PAWN) * 0xf;
+
+/**
+ * Open-addressing table from material keys to endings, built at compile time. A probe is a
+ * multiplication and usually a single comparison, since the table is mostly empty.
+ */
+struct EndgameTable {
+	static constexpr int SIZE = 64;
+	Endgame slots[SIZE];
+
+	static constexpr int slot(uint64_t key) { return (key * 0x9e3779b97f4a7c15ULL) >> 58; }
+
+	constexpr void insert(uint64_t key, EndgameType type, bool strong, uint8_t scale) {
+		int i = slot(key);
+		for (; slots[i].used; i = (i + 1) % SIZE) {
+			if (slots[i].key == key)
+				return; // Symmetric endings such as KvK are only added once
+		}
+		slots[i] = {key, type, strong, scale, true};
+	}
+
+	constexpr void add(const char *code, EndgameType type, uint8_t scale = SCALE_NORMAL) {
+		insert(endgame_key(code), type, WHITE, scale);
+		insert(mirror_key(endgame_key(code)), type, BLACK, scale);
+	}
+
+	constexpr EndgameTable() : slots() {
+		add("KvK", ENDGAME_DRAW);
+		add("KBvK", ENDGAME_DRAW);
+		add("KNvK", ENDGAME_DRAW);
+
+		add("KNNvK", ENDGAME_SCALE, 0); // Can't be forced
+		add("KRvKB", ENDGAME_SCALE, 16);
+		add("KRvKN", ENDGAME_SCALE, 16);
+
+		add("KQvK", ENDGAME_KXK);
+		add("KRvK", ENDGAME_KXK);
+		add("KBNvK", ENDGAME_KBNK);
+		add("KBBvK", ENDGAME_KBBK);
+	}
+
+	constexpr const Endgame *probe(uint64_t key) const {
+		for (int i = slot(key); slots[i].used; i = (i + 1) % SIZE) {
+			if (slots[i].key == key)
+				return &slots[i];
+		}
+		return nullptr;
+	}
+};
+
+inline constexpr EndgameTable ENDGAMES;
+
+// Material of bishops of opposite colors, once the pawns are masked out with PAWN_KEY_MASK
+constexpr uint64_t OPPOSITE_BISHOPS_KEY = endgame_key("KBvKB");
+
+// Whether eval() scores or scales positions with this material, instead of trusting the evaluation
+inline bool endgame_knowledge(uint64_t key) {
+	return ENDGAMES.probe(key) || (key & ~PAWN_KEY_MASK) == OPPOSITE_BISHOPS_KEY;
+}
+
+// Whether neither side has the material to mate (KvK, KBvK, KNvK)
+inline bool insufficient_material(const Board &board) {
+	const Endgame *endgame = ENDGAMES.probe(board.material_key);
+	return endgame && endgame->type == ENDGAME_DRAW;
+}
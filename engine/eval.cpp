@@ -1,46 +1,22 @@
 #include "eval.hpp"
+#include "endgame.hpp"
+#include "mappedfile.hpp"
+#ifdef HCE
+#include "movegen.hpp"
+#include "psqt.hpp"
+#endif
+
+#include <thread>
 
-Accumulator w_acc, b_acc;
-Network nnue_network;
-Piece prev_mailbox[64] = {};
 
 #ifdef HCE
-extern Bitboard king_movetable[64];
 
 static constexpr Value king_safety_lookup[9] = {-10, 20, 40, 50, 50, 50, 50, 50, 50};
 static constexpr Value multipawn_lookup[7] = {0, 0, 20, 40, 80, 160, 320};
 
-/**
- * @brief Boards to denote "good" squares for each piece type
- * @details The 8 boards map out an 8-bit signed binary number that represents how good or bad a square is for a piece type.
- * @details 127 is the best square for a piece, -128 is the worst.
- */
-Bitboard PAWN_SQUARES[8];
-Bitboard KNIGHT_SQUARES[8];
-Bitboard BISHOP_SQUARES[8];
-Bitboard ROOK_SQUARES[8];
-Bitboard QUEEN_SQUARES[8];
-Bitboard KING_SQUARES[8];
-Bitboard KING_ENDGAME_SQUARES[8];
-Bitboard PAWN_ENDGAME_SQUARES[8];
-
 Bitboard PASSED_PAWN_MASKS[2][64];
 
 __attribute__((constructor)) constexpr void gen_lookups() {
-	// Convert heatmaps
-	for (int i = 0; i < 8; i++) {
-		for (int j = 0; j < 64; j++) {
-			PAWN_SQUARES[7 - i] |= (((Bitboard)pawn_heatmap[j] >> i) & 1) << j;
-			KNIGHT_SQUARES[7 - i] |= (((Bitboard)knight_heatmap[j] >> i) & 1) << j;
-			BISHOP_SQUARES[7 - i] |= (((Bitboard)bishop_heatmap[j] >> i) & 1) << j;
-			ROOK_SQUARES[7 - i] |= (((Bitboard)rook_heatmap[j] >> i) & 1) << j;
-			QUEEN_SQUARES[7 - i] |= (((Bitboard)queen_heatmap[j] >> i) & 1) << j;
-			KING_SQUARES[7 - i] |= (((Bitboard)king_heatmap[j] >> i) & 1) << j;
-			KING_ENDGAME_SQUARES[7 - i] |= (((Bitboard)endgame_heatmap[j] >> i) & 1) << j;
-			PAWN_ENDGAME_SQUARES[7 - i] |= (((Bitboard)pawn_endgame[j] >> i) & 1) << j;
-		}
-	}
-
 	for (int i = 8; i < 56; i++) {
 		Bitboard white_mask = 0x0101010101010101ULL << (i + 8);
 		Bitboard black_mask = 0x8080808080808080ULL >> (71 - i);
@@ -60,15 +36,90 @@ float multi(int x) {
 
 void init_network() {
 #ifndef HCE
-	nnue_network.load();
-	for (int i = 0; i < HL_SIZE; i++) {
-		w_acc.val[i] = nnue_network.accumulator_biases[i];
-		b_acc.val[i] = nnue_network.accumulator_biases[i];
-	}
-	std::fill(prev_mailbox, prev_mailbox + 64, NO_PIECE);
+	load_embedded_network();
 #endif
 }
 
+EvalCache eval_cache(DEFAULT_EVAL_CACHE_MB);
+
+void EvalCache::resize(int mb) {
+	delete[] entries;
+	entries = nullptr;
+	mask = 0;
+	uint64_t size = (uint64_t)mb * 1024 * 1024 / sizeof(uint64_t);
+	if (size == 0)
+		return;
+	while (size & (size - 1))
+		size &= size - 1;
+	entries = new uint64_t[size];
+	mask = size - 1;
+	clear();
+}
+
+void EvalCache::clear() {
+	if (entries)
+		std::fill(entries, entries + mask + 1, 0);
+	probes = hits = 0;
+}
+
+// Number of king moves between two squares
+static int distance(int a, int b) {
+	return std::max(abs((a >> 3) - (b >> 3)), abs((a & 7) - (b & 7)));
+}
+
+// Number of king moves from a square to the central four, 3 on the edges
+static int center_distance(int sq) {
+	return std::max(std::max(3 - (sq >> 3), (sq >> 3) - 4), std::max(3 - (sq & 7), (sq & 7) - 4));
+}
+
+/**
+ * Scores the endings of the endgame table that don't need the regular evaluation (see endgame.hpp).
+ *
+ * Insufficient material is a draw. A trivial win is worth VALUE_KNOWN_WIN and the material, plus
+ * bonuses for driving the weak king to the edge (to a corner of the bishop's color in KBNK) and
+ * for bringing the strong king close to it, which is all the search needs to find the mate.
+ */
+static bool endgame_score(const Board &board, const Endgame *endgame, Value &score) {
+	if (!endgame || endgame->type == ENDGAME_SCALE)
+		return false;
+	if (endgame->type == ENDGAME_DRAW) {
+		score = 0;
+		return true;
+	}
+
+	bool strong = endgame->strong;
+	int strong_king = _tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(strong)]);
+	int weak_king = _tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(!strong)]);
+	bool dark_bishop = board.piece_boards[BISHOP] & DarkSquares, light_bishop = board.piece_boards[BISHOP] & ~DarkSquares;
+	int edge;
+	if (endgame->type == ENDGAME_KBNK) {
+		int corner = dark_bishop ? std::min(distance(weak_king, SQ_A1), distance(weak_king, SQ_H8))
+								 : std::min(distance(weak_king, SQ_A8), distance(weak_king, SQ_H1));
+		edge = 20 * (7 - corner);
+	} else if (endgame->type == ENDGAME_KBBK && !(dark_bishop && light_bishop)) {
+		score = 0; // Bishops of the same color can't mate
+		return true;
+	} else {
+		edge = 40 * center_distance(weak_king);
+	}
+	int proximity = 10 * (7 - distance(strong_king, weak_king));
+
+	score = VALUE_KNOWN_WIN + (board.material[strong] - board.material[!strong] + edge + proximity) * CP_SCALE_FACTOR;
+	if (strong == BLACK)
+		score = -score;
+	return true;
+}
+
+// Drawish endings of the endgame table, and opposite colored bishops, keep only part of their score
+static Value scale_endgame(const Board &board, const Endgame *endgame, Value score) {
+	if (endgame && endgame->type == ENDGAME_SCALE)
+		return score * endgame->scale / SCALE_NORMAL;
+	if ((board.material_key & ~PAWN_KEY_MASK) == OPPOSITE_BISHOPS_KEY && (board.piece_boards[BISHOP] & DarkSquares) &&
+		(board.piece_boards[BISHOP] & ~DarkSquares))
+		return score * SCALE_OPPOSITE_BISHOPS / SCALE_NORMAL;
+	return score;
+}
+
 #ifdef HCE
 Value eval(Board &board) {
 	if (!(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])) {
@@ -80,6 +131,11 @@ Value eval(Board &board) {
 		return -VALUE_MATE;
 	}
 
+	const Endgame *endgame = ENDGAMES.probe(board.material_key);
+	Value score;
+	if (endgame_score(board, endgame, score))
+		return score;
+
 	Value material = 0;
 	Value piecesquare = 0;
 	Value castling = 0;
@@ -88,54 +144,11 @@ Value eval(Board &board) {
 	Value tempo_bonus = 0;
 	Value pawn_structure = 0;
 
-	material += PawnValue * _mm_popcnt_u64(board.piece_boards[PAWN] & board.piece_boards[OCC(WHITE)]);
-	material += KnightValue * _mm_popcnt_u64(board.piece_boards[KNIGHT] & board.piece_boards[OCC(WHITE)]);
-	material += BishopValue * _mm_popcnt_u64(board.piece_boards[BISHOP] & board.piece_boards[OCC(WHITE)]);
-	material += RookValue * _mm_popcnt_u64(board.piece_boards[ROOK] & board.piece_boards[OCC(WHITE)]);
-	material += QueenValue * _mm_popcnt_u64(board.piece_boards[QUEEN] & board.piece_boards[OCC(WHITE)]);
-	material -= PawnValue * _mm_popcnt_u64(board.piece_boards[PAWN] & board.piece_boards[OCC(BLACK)]);
-	material -= KnightValue * _mm_popcnt_u64(board.piece_boards[KNIGHT] & board.piece_boards[OCC(BLACK)]);
-	material -= BishopValue * _mm_popcnt_u64(board.piece_boards[BISHOP] & board.piece_boards[OCC(BLACK)]);
-	material -= RookValue * _mm_popcnt_u64(board.piece_boards[ROOK] & board.piece_boards[OCC(BLACK)]);
-	material -= QueenValue * _mm_popcnt_u64(board.piece_boards[QUEEN] & board.piece_boards[OCC(BLACK)]);
-
-	// Decide between normal vs endgame king map
-	const Bitboard *funny = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) >= 10 ? KING_SQUARES : KING_ENDGAME_SQUARES;
-	const Bitboard *pawn = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) >= 10 ? PAWN_SQUARES : PAWN_ENDGAME_SQUARES;
-	// Initialize accumulators
-	int8_t pawn_acc, knight_acc, bishop_acc, rook_acc, queen_acc, king_acc;
-	int8_t pawn_acc_black, knight_acc_black, bishop_acc_black, rook_acc_black, queen_acc_black, king_acc_black;
-	pawn_acc = knight_acc = bishop_acc = rook_acc = queen_acc = king_acc = 0;
-	pawn_acc_black = knight_acc_black = bishop_acc_black = rook_acc_black = queen_acc_black = king_acc_black = 0;
-
-	// Precompute piece boards (flipping for black)
-	Bitboard boards[12];
-	for (int i = 0; i < 6; i++) {
-		boards[i] = board.piece_boards[i] & board.piece_boards[OCC(WHITE)];
-#ifndef WINDOWS
-		boards[i + 6] = __bswap_64(board.piece_boards[i] & board.piece_boards[OCC(BLACK)]);
-#else
-		boards[i + 6] = _byteswap_ulong(board.piece_boards[i] & board.piece_boards[OCC(BLACK)]);
-#endif
-	}
+	material = board.material[WHITE] - board.material[BLACK]; // Maintained incrementally by make_move
 
-	for (int i = 0; i < 8; i++) {
-		pawn_acc = pawn_acc * 2 + _mm_popcnt_u64(boards[0] & pawn[i]);
-		knight_acc = knight_acc * 2 + _mm_popcnt_u64(boards[1] & KNIGHT_SQUARES[i]);
-		bishop_acc = bishop_acc * 2 + _mm_popcnt_u64(boards[2] & BISHOP_SQUARES[i]);
-		rook_acc = rook_acc * 2 + _mm_popcnt_u64(boards[3] & ROOK_SQUARES[i]);
-		queen_acc = queen_acc * 2 + _mm_popcnt_u64(boards[4] & QUEEN_SQUARES[i]);
-		king_acc = king_acc * 2 + _mm_popcnt_u64(boards[5] & funny[i]);
-
-		pawn_acc_black = pawn_acc_black * 2 + _mm_popcnt_u64(boards[6] & pawn[i]);
-		knight_acc_black = knight_acc_black * 2 + _mm_popcnt_u64(boards[7] & KNIGHT_SQUARES[i]);
-		bishop_acc_black = bishop_acc_black * 2 + _mm_popcnt_u64(boards[8] & BISHOP_SQUARES[i]);
-		rook_acc_black = rook_acc_black * 2 + _mm_popcnt_u64(boards[9] & ROOK_SQUARES[i]);
-		queen_acc_black = queen_acc_black * 2 + _mm_popcnt_u64(boards[10] & QUEEN_SQUARES[i]);
-		king_acc_black = king_acc_black * 2 + _mm_popcnt_u64(boards[11] & funny[i]);
-	}
-	piecesquare += pawn_acc + knight_acc + bishop_acc + rook_acc + queen_acc + king_acc;
-	piecesquare -= pawn_acc_black + knight_acc_black + bishop_acc_black + rook_acc_black + queen_acc_black + king_acc_black;
+	// Piece-square tables are maintained incrementally by make_move, blend them by game phase
+	int mg_phase = std::min(board.phase, MAX_PHASE);
+	piecesquare = (board.psqt[MG] * mg_phase + board.psqt[EG] * (MAX_PHASE - mg_phase)) / MAX_PHASE;
 
 	castling += (board.castling & WHITE_OO) ? 5 : 0;
 	castling += (board.castling & WHITE_OOO) ? 5 : 0;
@@ -219,14 +232,177 @@ Value eval(Board &board) {
 
 	int npieces = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
 
-	return ((int)material * 3 + (int)piecesquare + (int)castling + (int)bishop_pair + (int)king_safety * 2 + (int)tempo_bonus + (int)pawn_structure) *
-		   multi(npieces);
+	score = ((int)material * 3 + (int)piecesquare + (int)castling + (int)bishop_pair + (int)king_safety * 2 + (int)tempo_bonus + (int)pawn_structure) *
+			multi(npieces);
+	return scale_endgame(board, endgame, score);
 }
 
 std::array<Value, 8> debug_eval(Board &board) {
 	return {eval(board), 0, 0, 0, 0, 0, 0, 0};
 }
+
+void eval_children(Board &board, const pzstd::vector<Move> &moves, Value *scores) {
+	// The HCE has no accumulator to share, so just play the moves
+	for (int i = 0; i < moves.size(); i++) {
+		board.make_move(moves[i]);
+		scores[i] = eval(board);
+		board.unmake_move();
+	}
+}
 #else
+/*
+ * The functions below are templates over the network architecture. The entry points pick the
+ * instantiation of the network in use with with_network.
+ */
+
+// Whether a move changes the king key (see NetworkArch::king_key) of perspective p, so that p has to be refreshed
+template <typename Arch>
+static bool needs_refresh(const BoardDelta &delta, bool p) {
+	if constexpr (Arch::KING_BUCKETS == 1)
+		return false;
+	else
+		return delta.nsub && delta.sub_piece[0] == (p ? BLACK_KING : WHITE_KING) && Arch::king_key(delta.sub_sq[0], p) != Arch::king_key(delta.add_sq[0], p);
+}
+
+/**
+ * Compute the accumulator of one perspective for the board as it is.
+ *
+ * Rather than starting from the biases, this starts from the last accumulator refreshed with the
+ * same king key (the board's Finny table), and only adds and removes the pieces that differ.
+ */
+template <typename Arch>
+static void refresh_perspective(const Network<Arch> &net, Board &board, AccumulatorEntry &entry, bool p, Square ksq) {
+	FinnyEntry &cached = (*board.accumulators).finny_table[p * FINNY_SIZE + Arch::king_key(ksq, p)];
+	Accumulator<Arch> &acc = cached.acc<Arch>();
+	if (!cached.valid) {
+		memcpy(acc.val, net.accumulator_biases, sizeof(acc.val));
+		memset(cached.piece_boards, 0, sizeof(cached.piece_boards));
+		cached.valid = true;
+	}
+	for (int side = 0; side < 2; side++) {
+		for (int pt = PAWN; pt <= KING; pt++) {
+			Bitboard old_pieces = cached.piece_boards[pt] & cached.piece_boards[OCC(side)];
+			Bitboard new_pieces = board.piece_boards[pt] & board.piece_boards[OCC(side)];
+			for (Bitboard added = new_pieces & ~old_pieces; added; added = _blsr_u64(added))
+				accumulator_add(net, acc, Arch::feature_index((Square)_tzcnt_u64(added), (PieceType)pt, side, p, ksq));
+			for (Bitboard removed = old_pieces & ~new_pieces; removed; removed = _blsr_u64(removed))
+				accumulator_sub(net, acc, Arch::feature_index((Square)_tzcnt_u64(removed), (PieceType)pt, side, p, ksq));
+		}
+	}
+	memcpy(cached.piece_boards, board.piece_boards, sizeof(cached.piece_boards));
+	entry.acc<Arch>()[p] = acc;
+}
+
+static inline Square king_square(const Board &board, bool side) {
+	return (Square)_tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(side)]);
+}
+
+// Compute both accumulators of the board
+template <typename Arch>
+static void refresh_accumulators(const Network<Arch> &net, Board &board, AccumulatorEntry &entry) {
+	refresh_perspective(net, board, entry, WHITE, king_square(board, WHITE));
+	refresh_perspective(net, board, entry, BLACK, king_square(board, BLACK));
+}
+
+/**
+ * Derive the accumulator of perspective p from that of the parent position and the move's delta.
+ *
+ * The move must not need a refresh for p, so that the parent and the child share the king key
+ * of `ksq`, the king square of p in either of them.
+ */
+template <typename Arch>
+static void apply_delta(const Network<Arch> &net, const AccumulatorEntry &parent, AccumulatorEntry &entry, const BoardDelta &delta, bool p, Square ksq) {
+	const Accumulator<Arch> &src = parent.acc<Arch>()[p];
+	Accumulator<Arch> &dst = entry.acc<Arch>()[p];
+	uint16_t add[2], sub[2];
+	for (int i = 0; i < delta.nadd; i++)
+		add[i] = Arch::feature_index(delta.add_sq[i], PieceType(delta.add_piece[i] & 7), delta.add_piece[i] >> 3, p, ksq);
+	for (int i = 0; i < delta.nsub; i++)
+		sub[i] = Arch::feature_index(delta.sub_sq[i], PieceType(delta.sub_piece[i] & 7), delta.sub_piece[i] >> 3, p, ksq);
+
+	if (delta.nadd == 1 && delta.nsub == 1) // Quiet move
+		accumulator_add_sub(net, src, dst, add[0], sub[0]);
+	else if (delta.nadd == 1 && delta.nsub == 2) // Capture
+		accumulator_add_sub2(net, src, dst, add[0], sub[0], sub[1]);
+	else if (delta.nadd == 2 && delta.nsub == 2) // Castling
+		accumulator_add2_sub2(net, src, dst, add[0], add[1], sub[0], sub[1]);
+	else // Null move
+		dst = src;
+}
+
+/**
+ * Bring the accumulators of the current position up to date.
+ * 
+ * make_move only records what changed, so nodes that never get evaluated (TT cutoffs, null
+ * moves, ...) cost nothing here. When a node does need its accumulators, we walk back to the
+ * closest position on the line that was already computed and replay the deltas from there,
+ * caching every intermediate position for its siblings. If there is none, or a king move on
+ * the way changed the king key, the accumulators are refreshed from the board.
+ *
+ * Each perspective is handled on its own, since a king move only forces its own side to refresh.
+ */
+template <typename Arch>
+static AccumulatorEntry &update_accumulators(const Network<Arch> &net, Board &board) {
+	AccumulatorEntry *stack = (*board.accumulators).stack;
+	uint32_t ply = board.acc_ply;
+	AccumulatorEntry &cur = stack[ply % ACC_STACK_SIZE];
+	if (cur.computed[WHITE] && cur.computed[BLACK] && cur.ply == ply)
+		return cur;
+
+	// Entries whose ply doesn't match were overwritten by a line longer than the stack
+	bool linked = cur.ply == ply;
+	if (!linked) {
+		cur.ply = ply;
+		cur.computed[WHITE] = cur.computed[BLACK] = false;
+	}
+
+	for (bool p : {WHITE, BLACK}) {
+		if (cur.computed[p])
+			continue;
+		Square ksq = king_square(board, p);
+		uint32_t base = ply;
+		bool found = false;
+		while (linked && base > 0 && ply - base < ACC_STACK_SIZE - 1) {
+			if (needs_refresh<Arch>(stack[base % ACC_STACK_SIZE].delta, p))
+				break;
+			AccumulatorEntry &entry = stack[(base - 1) % ACC_STACK_SIZE];
+			if (entry.ply != base - 1)
+				break;
+			base--;
+			if (entry.computed[p]) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			refresh_perspective(net, board, cur, p, ksq);
+		} else {
+			for (uint32_t i = base + 1; i <= ply; i++) {
+				AccumulatorEntry &entry = stack[i % ACC_STACK_SIZE];
+				apply_delta(net, stack[(i - 1) % ACC_STACK_SIZE], entry, entry.delta, p, ksq);
+				entry.computed[p] = true;
+			}
+		}
+		cur.computed[p] = true;
+	}
+	return cur;
+}
+
+template <typename Arch>
+static Value eval_nnue(const Network<Arch> &net, Board &board) {
+	AccumulatorEntry &entry = update_accumulators(net, board);
+	const Accumulator<Arch> *acc = entry.acc<Arch>();
+
+	int npieces = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
+	int nbucket = Arch::output_bucket(npieces);
+
+	if (board.side == WHITE)
+		return nnue_eval(net, acc[WHITE], acc[BLACK], nbucket);
+	else
+		return -nnue_eval(net, acc[BLACK], acc[WHITE], nbucket);
+}
+
 Value eval(Board &board) {
 	if (!(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])) {
 		// If black has no king, this is mate for white
@@ -237,46 +413,197 @@ Value eval(Board &board) {
 		return -VALUE_MATE;
 	}
 
+	// Known endings are scored without the network
+	const Endgame *endgame = ENDGAMES.probe(board.material_key);
+	Value score;
+	if (endgame_score(board, endgame, score))
+		return score;
+
+	// Transpositions are common in qsearch, so the NNUE work can often be skipped entirely
+	// (the accumulators are left alone, update_accumulators catches up lazily if needed)
+	if (eval_cache.probe(board.zobrist, score))
+		return score;
+
 	// Query the NNUE network
-	for (uint16_t i = 0; i < 64; i++) {
-		Piece piece = board.mailbox[i];
-		Piece prev_piece = prev_mailbox[i];
-		if (piece == prev_piece)
-			continue; // No change
-		bool side = piece >> 3; // 1 = black, 0 = white
-		bool prev_side = prev_piece >> 3; // 1 = black, 0 = white
-		PieceType pt = PieceType(piece & 7);
-		PieceType prev_pt = PieceType(prev_piece & 7);
-
-		if (piece != NO_PIECE) {
-			// Add to accumulator
-			uint16_t w_index = calculate_index((Square)i, pt, side, 0);
-			accumulator_add(nnue_network, w_acc, w_index);
-			uint16_t b_index = calculate_index((Square)i, pt, side, 1);
-			accumulator_add(nnue_network, b_acc, b_index);
+	score = with_network([&](const auto &net) { return eval_nnue(net, board); });
+	score = scale_endgame(board, endgame, score);
+	eval_cache.store(board.zobrist, score);
+	return score;
+}
+
+template <typename Arch>
+static void eval_children_nnue(const Network<Arch> &net, Board &board, const pzstd::vector<Move> &moves, Value *scores) {
+	AccumulatorEntry &parent = update_accumulators(net, board);
+	int npieces = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
+	Square ksq[2] = {king_square(board, WHITE), king_square(board, BLACK)};
+	AccumulatorEntry child;
+	const Accumulator<Arch> *acc = child.acc<Arch>();
+
+	for (int n = 0; n < moves.size(); n++) {
+		BoardDelta delta = board.move_delta(moves[n]);
+		bool side = delta.sub_piece[0] >> 3;
+		if (delta.nsub > delta.nadd && (delta.sub_piece[1] & 7) == KING) {
+			scores[n] = side == WHITE ? VALUE_MATE : -VALUE_MATE;
+			continue;
 		}
+		uint64_t material_key = board.material_key;
+		for (int i = 0; i < delta.nsub; i++)
+			material_key -= material_key_unit(delta.sub_piece[i]);
+		for (int i = 0; i < delta.nadd; i++)
+			material_key += material_key_unit(delta.add_piece[i]);
+		if (needs_refresh<Arch>(delta, side) || endgame_knowledge(material_key)) {
+			// The child needs a refresh, which takes the board it is on, or is an ending that eval() handles itself
+			board.make_move(moves[n]);
+			scores[n] = eval(board);
+			board.unmake_move();
+			continue;
+		}
+		apply_delta(net, parent, child, delta, WHITE, ksq[WHITE]);
+		apply_delta(net, parent, child, delta, BLACK, ksq[BLACK]);
+
+		// The child has the other side to move, and one piece fewer after a capture
+		int nbucket = Arch::output_bucket(npieces - (delta.nsub > delta.nadd));
+		if (side == BLACK)
+			scores[n] = nnue_eval(net, acc[WHITE], acc[BLACK], nbucket);
+		else
+			scores[n] = -nnue_eval(net, acc[BLACK], acc[WHITE], nbucket);
+	}
+}
 
-		if (prev_piece != NO_PIECE) {
-			// Subtract from accumulator
-			uint16_t w_index = calculate_index((Square)i, prev_pt, prev_side, 0);
-			accumulator_sub(nnue_network, w_acc, w_index);
-			uint16_t b_index = calculate_index((Square)i, prev_pt, prev_side, 1);
-			accumulator_sub(nnue_network, b_acc, b_index);
+/**
+ * Evaluate every child of the current position in one pass.
+ * 
+ * The parent accumulators are brought up to date once, and each child is then derived from
+ * them by applying the delta of its move, without making the move on the board. This gives the
+ * same scores as make_move + eval + unmake_move for a fraction of the cost, which makes NNUE
+ * scores affordable for move ordering. Children that reach an ending of endgame.hpp are
+ * evaluated on the board, so that they get the same endgame scores and scaling as in eval().
+ */
+void eval_children(Board &board, const pzstd::vector<Move> &moves, Value *scores) {
+	if (!(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)]) || !(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])) {
+		// There are no accumulators without both kings, and eval knows what to do
+		for (int i = 0; i < moves.size(); i++) {
+			board.make_move(moves[i]);
+			scores[i] = eval(board);
+			board.unmake_move();
 		}
+		return;
 	}
+	with_network([&](const auto &net) { eval_children_nnue(net, board, moves, scores); });
+}
 
-	memcpy(prev_mailbox, board.mailbox, sizeof(prev_mailbox));
+/**
+ * Microbenchmark of the output layer.
+ * 
+ * Runs nnue_eval over the accumulators of a few positions, and reports the time per call next
+ * to the time of a full eval() call that has to refresh its accumulators first.
+ */
+void bench_nnue() {
+	const char *fens[] = {
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	};
+	constexpr int N = sizeof(fens) / sizeof(fens[0]);
+	constexpr int ITERS = 1000000;
+
+	AccumulatorEntry entries[N];
+	Board boards[N] = {Board(fens[0]), Board(fens[1]), Board(fens[2]), Board(fens[3])};
+
+	int64_t checksum = 0;
+	double output_ns = with_network([&](const auto &net) {
+		using Arch = typename std::decay_t<decltype(net)>::Arch;
+		for (int i = 0; i < N; i++)
+			refresh_accumulators(net, boards[i], entries[i]);
+
+		clock_t start = clock();
+		for (int i = 0; i < ITERS; i++) {
+			const Accumulator<Arch> *acc = entries[i % N].acc<Arch>();
+			checksum += nnue_eval(net, acc[i & 1], acc[!(i & 1)], i % Arch::NBUCKETS);
+		}
+		return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ITERS;
+	});
+
+	clock_t start = clock();
+	for (int i = 0; i < ITERS / 10; i++) {
+		Board &board = boards[i % N];
+		board.reset_accumulators();
+		checksum += with_network([&](const auto &net) { return eval_nnue(net, board); }); // Bypassing the eval cache
+	}
+	double full_ns = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / (ITERS / 10);
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "network: " << network_name() << ", " << nnue_network.hl_size << " hidden neurons" << std::endl;
+	std::cout << "kernel: " << nnue_kernel() << std::endl;
+	std::cout << "nnue_eval: " << output_ns << " ns/call (" << 1e3 / output_ns << "M evals/s)" << std::endl;
+	std::cout << "eval with refresh: " << full_ns << " ns/call" << std::endl;
+	std::cout << "checksum " << checksum << std::endl;
+}
 
-	int npieces = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
-	int nbucket = (npieces - 2) / 4;
+/**
+ * Evaluate every position of a FEN/EPD file with the network, without searching.
+ *
+ * The file is memory-mapped and split into one run of lines per thread. Each thread loads its
+ * positions into its own board and evaluates them from scratch, which is cheap since the board's
+ * Finny table carries the pieces that consecutive positions share. Anything after the FEN on
+ * a line (EPD opcodes, results, ...) is ignored.
+ */
+bool eval_batch(const std::string &in, const std::string &out, int threads, std::string &error) {
+	MappedFile file;
+	if (!file.open(in, error))
+		return false;
+	const char *data = file.data(), *end = data + file.size();
+
+	// Split at line starts, so that every thread gets about the same number of bytes
+	threads = std::max(1, threads);
+	std::vector<const char *> bounds = {data};
+	for (int t = 1; t < threads; t++) {
+		const char *p = std::max(bounds.back(), data + file.size() * t / threads);
+		while (p < end && p != data && p[-1] != '\n')
+			p++;
+		bounds.push_back(p);
+	}
+	bounds.push_back(end);
+
+	std::vector<std::vector<Value>> scores(threads);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&, t] {
+			Board board;
+			std::string fen;
+			for (const char *line = bounds[t]; line < bounds[t + 1];) {
+				const char *eol = (const char *)memchr(line, '\n', bounds[t + 1] - line);
+				if (!eol)
+					eol = bounds[t + 1];
+				fen.assign(line, eol);
+				line = eol + 1;
+				if (fen.find('/') == std::string::npos)
+					continue; // Blank line or header
+				board.load_fen(fen);
+				// Not through eval, whose cache isn't shared between threads
+				if (!(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)]))
+					scores[t].push_back(VALUE_MATE);
+				else if (!(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)]))
+					scores[t].push_back(-VALUE_MATE);
+				else
+					scores[t].push_back(with_network([&](const auto &net) { return eval_nnue(net, board); }));
+			}
+		});
+	}
+	for (std::thread &worker : workers)
+		worker.join();
 
-	int32_t score;
-	if (board.side == WHITE) {
-		score = nnue_eval(nnue_network, w_acc, b_acc, nbucket);
-	} else {
-		score = -nnue_eval(nnue_network, b_acc, w_acc, nbucket);
+	std::ofstream output(out);
+	for (const std::vector<Value> &chunk : scores) {
+		for (Value score : chunk)
+			output << score << '\n';
 	}
-	return score;
+	if (!output) {
+		error = "cannot write " + out;
+		return false;
+	}
+	return true;
 }
 
 std::array<Value, 8> debug_eval(Board &board) {
@@ -292,49 +619,18 @@ std::array<Value, 8> debug_eval(Board &board) {
 		return {0, 0, 0, 0, 0, 0, 0, 0}; // Draw by 50 moves
 	}
 
-	// Query the NNUE network
-	for (uint16_t i = 0; i < 64; i++) {
-		Piece piece = board.mailbox[i];
-		Piece prev_piece = prev_mailbox[i];
-		if (piece == prev_piece)
-			continue; // No change
-		bool side = piece >> 3; // 1 = black, 0 = white
-		bool prev_side = prev_piece >> 3; // 1 = black, 0 = white
-		PieceType pt = PieceType(piece & 7);
-		PieceType prev_pt = PieceType(prev_piece & 7);
-
-		if (piece != NO_PIECE) {
-			// Add to accumulator
-			uint16_t w_index = calculate_index((Square)i, pt, side, 0);
-			accumulator_add(nnue_network, w_acc, w_index);
-			uint16_t b_index = calculate_index((Square)i, pt, side, 1);
-			accumulator_add(nnue_network, b_acc, b_index);
-		}
-
-		if (prev_piece != NO_PIECE) {
-			// Subtract from accumulator
-			uint16_t w_index = calculate_index((Square)i, prev_pt, prev_side, 0);
-			accumulator_sub(nnue_network, w_acc, w_index);
-			uint16_t b_index = calculate_index((Square)i, prev_pt, prev_side, 1);
-			accumulator_sub(nnue_network, b_acc, b_index);
+	// Query the NNUE network, with every output bucket
+	return with_network([&](const auto &net) {
+		using Arch = typename std::decay_t<decltype(net)>::Arch;
+		const Accumulator<Arch> *acc = update_accumulators(net, board).template acc<Arch>();
+		std::array<Value, 8> score = {};
+		for (int i = 0; i < std::min(Arch::NBUCKETS, 8); i++) {
+			if (board.side == WHITE)
+				score[i] = nnue_eval(net, acc[WHITE], acc[BLACK], i);
+			else
+				score[i] = -nnue_eval(net, acc[BLACK], acc[WHITE], i);
 		}
-	}
-
-	memcpy(prev_mailbox, board.mailbox, sizeof(prev_mailbox));
-
-	int npieces = _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
-
-	std::array<Value, 8> score = {};
-	if (board.side == WHITE) {
-		// score = nnue_eval(nnue_network, w_acc, b_acc, nbucket);
-		for (int i = 0; i < 8; i++) {
-			score[i] = nnue_eval(nnue_network, w_acc, b_acc, i);
-		}
-	} else {
-		for (int i = 0; i < 8; i++) {
-			score[i] = -nnue_eval(nnue_network, b_acc, w_acc, i);
-		}
-	}
-	return score;
+		return score;
+	});
 }
 #endif
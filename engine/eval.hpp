@@ -6,104 +6,68 @@
 
 void init_network();
 
-Value eval(Board &board);
+#define DEFAULT_EVAL_CACHE_MB 1
 
-std::array<Value, 8> debug_eval(Board &board);
+/**
+ * Cache of static evaluations, keyed by the position hash.
+ *
+ * Each entry packs the upper 48 bits of the key together with the score into a single word, so
+ * a probe is one load. The low bits of the key pick the entry, and a store simply replaces it.
+ */
+struct EvalCache {
+	uint64_t *entries = nullptr;
+	uint64_t mask = 0; // Number of entries - 1
+	uint64_t probes = 0, hits = 0;
 
-#ifdef HCE
-constexpr int pawn_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	0,	0,	0,	 0,	  0,   0,	0,	0, // 1
-	5,	10, 10,	 -40, -40, 10,	10, 5, // 2
-	5,	-5, -10, 0,	  0,   -10, -5, 5, // 3
-	0,	0,	0,	 30,  30,  0,	0,	0, // 4
-	5,	5,	10,	 40,  40,  10,	5,	5, // 5
-	10, 10, 50,	 60,  60,  50,	10, 10, // 6
-	80, 80, 80,	 80,  80,  80,	80, 80, // 7
-	0,	0,	0,	 0,	  0,   0,	0,	0, // 8
-};
+	EvalCache(int mb) { resize(mb); }
 
-constexpr int knight_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	-50, -40, -30, -30, -30, -30, -40, -50, // 1
-	-40, -20, 0,   5,	5,	 0,	  -20, -40, // 2
-	-30, 5,	  10,  15,	15,	 10,  5,   -30, // 3
-	-30, 0,	  15,  20,	20,	 15,  0,   -30, // 4
-	-30, 5,	  15,  20,	20,	 15,  5,   -30, // 5
-	-30, 0,	  10,  15,	15,	 10,  0,   -30, // 6
-	-40, -20, 0,   0,	0,	 0,	  -20, -40, // 7
-	-50, -40, -30, -30, -30, -30, -40, -50, // 8
-};
+	~EvalCache() { delete[] entries; }
 
-constexpr int bishop_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	-20, -10, -10, -10, -10, -10, -10, -20, // 1
-	-10, 5,	  0,   0,	0,	 0,	  5,   -10, // 2
-	-10, 10,  10,  10,	10,	 10,  10,  -10, // 3
-	-10, 0,	  10,  10,	10,	 10,  0,   -10, // 4
-	-10, 5,	  5,   10,	10,	 5,	  5,   -10, // 5
-	-10, 0,	  5,   10,	10,	 5,	  0,   -10, // 6
-	-30, 0,	  0,   0,	0,	 0,	  0,   -30, // 7
-	-20, -10, -10, -10, -10, -10, -10, -20, // 8
-};
+	EvalCache(const EvalCache &) = delete;
+	EvalCache &operator=(const EvalCache &) = delete;
 
-constexpr int rook_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	-10, 0, 0, 10, 10, 5, 0, -10, // 1
-	-5,	 0, 0, 0,  0,  0, 0, -5, // 2
-	-5,	 0, 0, 0,  0,  0, 0, -5, // 3
-	-5,	 0, 0, 0,  0,  0, 0, -5, // 4
-	-5,	 0, 0, 0,  0,  0, 0, -5, // 5
-	-5,	 0, 0, 0,  0,  0, 0, -5, // 6
-	-10, 0, 0, 0,  0,  0, 0, -10, // 7
-	0,	 0, 0, 0,  0,  0, 0, 0, // 8
-};
+	// Use (a power of two number of entries up to) `mb` megabytes, 0 disables the cache
+	void resize(int mb);
 
-constexpr int queen_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	-20, -10, -10, -5, -5, -10, -10, -20, // 1
-	-10, 0,	  5,   0,  0,  0,	0,	 -10, // 2
-	-10, 5,	  5,   5,  5,  5,	0,	 -10, // 3
-	-5,	 0,	  5,   5,  5,  5,	0,	 -5, // 4
-	0,	 0,	  5,   5,  5,  5,	0,	 -5, // 5
-	-10, 0,	  5,   5,  5,  5,	0,	 -10, // 6
-	-10, 0,	  0,   0,  0,  0,	0,	 -10, // 7
-	-20, -10, -10, -5, -5, -10, -10, -20, // 8
-};
+	// Forget every score, e.g. when the network changes
+	void clear();
 
-constexpr int king_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	30,	 50,  40,  0,	0,	 10,  50,  30, // 1
-	20,	 20,  -5,  -5,	-5,	 -5,  20,  20, // 2
-	-10, -20, -20, -20, -20, -20, -20, -10, // 3
-	-20, -30, -30, -40, -40, -30, -30, -20, // 4
-	-30, -40, -40, -50, -50, -40, -40, -30, // 5
-	-30, -40, -40, -50, -50, -40, -40, -30, // 6
-	-30, -40, -40, -50, -50, -40, -40, -30, // 7
-	-30, -40, -40, -50, -50, -40, -40, -30, // 8
-};
+	bool probe(uint64_t key, Value &value) {
+		if (!entries)
+			return false;
+		probes++;
+		uint64_t entry = entries[key & mask];
+		if ((entry ^ key) >> 16)
+			return false;
+		hits++;
+		value = (Value)(uint16_t)entry;
+		return true;
+	}
 
-constexpr int endgame_heatmap[64] = {
-	//  a  b  c  d  e  f  g  h
-	1, 2,  4,  8,  8,  4,  2,  1, // 1
-	2, 4,  8,  16, 16, 8,  4,  2, // 2
-	4, 8,  16, 32, 32, 16, 8,  4, // 3
-	8, 16, 32, 64, 64, 32, 16, 8, // 4
-	8, 16, 32, 64, 64, 32, 16, 8, // 5
-	4, 8,  16, 32, 32, 16, 8,  4, // 6
-	2, 4,  8,  16, 16, 8,  4,  2, // 7
-	1, 2,  4,  8,  8,  4,  2,  1, // 8
-};
+	// Start loading the entry of a position that is about to be evaluated
+	void prefetch(uint64_t key) const {
+		if (entries)
+			_mm_prefetch((const char *)&entries[key & mask], _MM_HINT_T0);
+	}
 
-constexpr int pawn_endgame[64] = {
-	//  a  b  c  d  e  f  g  h
-	0,	 0,	  0,   0,	0,	 0,	  0,   0, // 1
-	-10, -10, -10, -10, -10, -10, -10, -10, // 2
-	5,	 5,	  5,   5,	5,	 5,	  5,   5, // 3
-	10,	 10,  10,  10,	10,	 10,  10,  10, // 4
-	20,	 20,  20,  20,	20,	 20,  20,  20, // 5
-	60,	 60,  60,  60,	60,	 60,  60,  60, // 6
-	100, 100, 100, 100, 100, 100, 100, 100, // 7
-	0,	 0,	  0,   0,	0,	 0,	  0,   0, // 8
+	void store(uint64_t key, Value value) {
+		if (entries)
+			entries[key & mask] = (key & ~0xffffULL) | (uint16_t)value;
+	}
 };
-#endif
\ No newline at end of file
+
+extern EvalCache eval_cache;
+
+Value eval(Board &board);
+
+// Evaluate each child of the position (in the same perspective as eval) without making the moves
+void eval_children(Board &board, const pzstd::vector<Move> &moves, Value *scores);
+
+std::array<Value, 8> debug_eval(Board &board);
+
+#ifndef HCE
+void bench_nnue();
+
+// Write the static eval (from white's point of view) of every position in the FEN/EPD file `in` to `out`, one per line
+bool eval_batch(const std::string &in, const std::string &out, int threads, std::string &error);
+#endif
@@ -12,9 +12,30 @@
 #include <stack>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "pzstl/vector.hpp"
 
+// Portable builds (`make ARCH=x86-64-v2`) can't assume BMI1, LZCNT or POPCNT, so the bit twiddling
+// intrinsics fall back to compiler builtins that are safe on any x86-64 CPU
+#ifndef __LZCNT__
+inline uint64_t pz_lzcnt_u64(uint64_t x) { return x ? __builtin_clzll(x) : 64; }
+#define _lzcnt_u64 pz_lzcnt_u64
+#endif
+#ifndef __BMI__
+inline uint64_t pz_tzcnt_u64(uint64_t x) { return x ? __builtin_ctzll(x) : 64; }
+inline uint64_t pz_blsr_u64(uint64_t x) { return x & (x - 1); }
+inline uint64_t pz_blsmsk_u64(uint64_t x) { return x ^ (x - 1); }
+#define _tzcnt_u64 pz_tzcnt_u64
+#define __tzcnt_u64 pz_tzcnt_u64
+#define _blsr_u64 pz_blsr_u64
+#define _blsmsk_u64 pz_blsmsk_u64
+#endif
+#ifndef __POPCNT__
+inline int64_t pz_popcnt_u64(uint64_t x) { return __builtin_popcountll(x); }
+#define _mm_popcnt_u64 pz_popcnt_u64
+#endif
+
 #define VERSION "v20250427T15"
 
 typedef uint64_t Bitboard;
@@ -69,6 +90,11 @@ enum Piece : uint8_t {
 
 constexpr Value PieceValue[] = {PawnValue, KnightValue, BishopValue, RookValue, QueenValue, VALUE_INFINITE - VALUE_MAX};
 
+// Material and game phase contributed by each piece type (kings count for neither)
+constexpr Value MaterialValue[] = {PawnValue, KnightValue, BishopValue, RookValue, QueenValue, 0, 0};
+constexpr uint8_t PhaseValue[] = {0, 1, 1, 2, 4, 0, 0};
+constexpr uint8_t MAX_PHASE = 24; // Phase of the starting position
+
 enum CastlingRights : uint8_t { NO_CASTLE, WHITE_OO, WHITE_OOO = WHITE_OO << 1, BLACK_OO = WHITE_OO << 2, BLACK_OOO = WHITE_OO << 3 };
 
 // clang-format off
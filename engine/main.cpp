@@ -5,34 +5,91 @@
 
 #include "bitboard.hpp"
 #include "eval.hpp"
+#include "mate.hpp"
 #include "movegen.hpp"
 #include "movetimings.hpp"
 #include "search.hpp"
 
-int TT_SIZE = DEFAULT_TT_SIZE;
-
 int main(int argc, char *argv[]) {
+	if (argc == 2 && std::string(argv[1]) == "startup") {
+		// Startup latency: CPU time spent before main (loading and static initialization), then in init_network
+		uint64_t start = clock();
+		init_network();
+		uint64_t end = clock();
+		std::cout << "static init " << start * 1000000 / CLOCKS_PER_SEC << " us, network " << (end - start) * 1000000 / CLOCKS_PER_SEC << " us"
+				  << std::endl;
+		return 0;
+	}
 	if (argc == 2 && std::string(argv[1]) == "bench") {
-		Board board = Board(TT_SIZE);
+		Board board;
 		init_network();
 		uint64_t start = clock();
 		search_depth(board, 10, true);
 		uint64_t end = clock();
+		std::cout << "eval cache: " << eval_cache.probes << " probes, " << std::fixed << std::setprecision(1)
+				  << (eval_cache.probes ? 100.0 * eval_cache.hits / eval_cache.probes : 0.0) << "% hits" << std::endl;
+		std::cout << std::setprecision(0);
 		std::cout << nodes << " nodes " << (nodes / ((double)(end - start) / CLOCKS_PER_SEC)) << " nps" << std::endl;
 		return 0;
 	}
+	if (argc == 2 && std::string(argv[1]) == "movebench") {
+		bench_movegen();
+		return 0;
+	}
+#ifndef HCE
+	if (argc == 2 && std::string(argv[1]) == "nnuebench") {
+		init_network();
+		bench_nnue();
+		return 0;
+	}
+	if (argc >= 4 && std::string(argv[1]) == "evalbatch") {
+		// Label a file of positions with raw network scores: evalbatch <in.epd> <out.txt> [--threads N]
+		int threads = std::thread::hardware_concurrency();
+		if (argc == 6 && std::string(argv[4]) == "--threads")
+			threads = std::stoi(argv[5]);
+		init_network();
+		std::string error;
+		if (!eval_batch(argv[2], argv[3], threads, error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+	if (argc == 4 && std::string(argv[1]) == "packnet") {
+		// Add a header to a raw network from the trainer, for use as an EvalFile
+		std::string error;
+		if (!pack_network_file(argv[2], argv[3], error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+#endif
 	bool online = argc == 2 && std::string(argv[1]) == "--online";
 	std::cout << "PZChessBot " << VERSION << " developed by kevlu8 and wdotmathree" << std::endl;
 	std::string command;
-	Board board = Board(TT_SIZE);
+	Board board;
 	init_network();
 	std::thread searchthread;
+	// The last `position` command, without its moves, and those moves
+	std::string position_base;
+	std::vector<std::string> position_moves;
 	while (getline(std::cin, command)) {
 		if (command == "uci") {
 			std::cout << "id name PZChessBot " << VERSION << std::endl;
 			std::cout << "id author kevlu8 and wdotmathree" << std::endl;
 			std::cout << "option name Hash type spin default 16 min 1 max 1024" << std::endl;
 			std::cout << "option name Threads type spin default 1 min 1 max 1" << std::endl; // Not implemented yet
+			std::cout << "option name MultiPV type spin default 1 min 1 max " << MAX_MULTIPV << std::endl;
+			std::cout << "option name EvalCache type spin default " << DEFAULT_EVAL_CACHE_MB << " min 0 max 256" << std::endl;
+#ifndef HCE
+			std::cout << "option name EvalFile type string default <embedded>" << std::endl;
+#endif
+#ifdef TUNE
+			for (TuneParam &param : tune_params()) {
+				std::cout << "option name " << param.name << " type spin default " << param.value << " min " << param.min << " max " << param.max << std::endl;
+			}
+#endif
 			std::cout << "uciok" << std::endl;
 		} else if (command == "isready") {
 			std::cout << "readyok" << std::endl;
@@ -44,7 +101,8 @@ int main(int argc, char *argv[]) {
 				if (token == "name") {
 					ss >> optionname;
 				} else if (token == "value") {
-					ss >> optionvalue;
+					// The rest of the line, so that paths may contain spaces
+					std::getline(ss >> std::ws, optionvalue);
 				}
 			}
 			if (optionname == "Hash") {
@@ -53,29 +111,73 @@ int main(int argc, char *argv[]) {
 					std::cerr << "Invalid hash size: " << optionint << std::endl;
 					continue;
 				}
-				TT_SIZE = optionint * 1024 * 1024 / sizeof(TTable::TTEntry);
+				ttable.resize(optionint * 1024 * 1024 / sizeof(TTable::TTEntry));
+			} else if (optionname == "MultiPV") {
+				int optionint = std::stoi(optionvalue);
+				if (optionint < 1 || optionint > MAX_MULTIPV) {
+					std::cerr << "Invalid MultiPV: " << optionint << std::endl;
+					continue;
+				}
+				multipv = optionint;
+			} else if (optionname == "EvalCache") {
+				int optionint = std::stoi(optionvalue);
+				if (optionint < 0 || optionint > 256) {
+					std::cerr << "Invalid eval cache size: " << optionint << std::endl;
+					continue;
+				}
+				eval_cache.resize(optionint);
 			}
-		} else if (command == "ucinewgame") {
-			board = Board(TT_SIZE);
-		} else if (command.substr(0, 8) == "position") {
-			// either `position startpos` or `position fen ...`
-			if (command.find("startpos") != std::string::npos) {
-				board = Board(TT_SIZE);
-			} else if (command.find("fen") != std::string::npos) {
-				std::string fen = command.substr(command.find("fen") + 4);
-				if (fen.find("moves") != std::string::npos) {
-					fen = fen.substr(0, fen.find("moves"));
+#ifndef HCE
+			else if (optionname == "EvalFile") {
+				std::string error;
+				if (optionvalue == "<embedded>" || optionvalue.empty()) {
+					load_embedded_network();
+				} else if (!load_network_file(optionvalue, error)) {
+					std::cout << "info string Failed to load " << optionvalue << ": " << error << std::endl;
+					continue;
 				}
-				board = Board(fen, TT_SIZE);
+				board.reset_accumulators();
+				eval_cache.clear();
+				std::cout << "info string Loaded " << network_name() << std::endl;
+			}
+#endif
+#ifdef TUNE
+			for (TuneParam &param : tune_params()) {
+				if (optionname == param.name)
+					param.value = std::clamp(std::stoi(optionvalue), param.min, param.max);
 			}
-			if (command.find("moves") != std::string::npos) {
-				std::string moves = command.substr(command.find("moves") + 6);
-				std::stringstream ss(moves);
+#endif
+		} else if (command == "ucinewgame") {
+			board = Board();
+			ttable.clear();
+			position_base.clear();
+		} else if (command.substr(0, 8) == "position") {
+			// `position startpos [moves ...]` or `position fen <fen> [moves ...]`
+			size_t moves_at = command.find("moves");
+			std::string base = command.substr(0, moves_at);
+			base.erase(base.find_last_not_of(' ') + 1);
+			std::vector<std::string> moves;
+			if (moves_at != std::string::npos) {
+				std::stringstream ss(command.substr(moves_at + 5));
 				std::string move;
-				while (ss >> move) {
-					board.make_move(Move::from_string(move, &board));
-				}
+				while (ss >> move)
+					moves.push_back(move);
+			}
+
+			// GUIs resend the whole game before every move, so if this extends the last position only play the new moves
+			size_t played = 0;
+			if (base == position_base && moves.size() >= position_moves.size() &&
+				std::equal(position_moves.begin(), position_moves.end(), moves.begin())) {
+				played = position_moves.size();
+			} else if (base.find("startpos") != std::string::npos) {
+				board = Board();
+			} else if (base.find("fen") != std::string::npos) {
+				board = Board(base.substr(base.find("fen") + 4));
 			}
+			for (size_t i = played; i < moves.size(); i++)
+				board.make_move(Move::from_string(moves[i], &board));
+			position_base = base;
+			position_moves = std::move(moves);
 		} else if (command == "quit") {
 			break;
 		} else if (command == "stop") {
@@ -97,7 +199,7 @@ int main(int argc, char *argv[]) {
 			}
 		} else if (command.substr(0, 2) == "go") {
 #ifndef HCE
-			std::cout << "info string Using " << NNUE_PATH << " for evaluation" << std::endl;
+			std::cout << "info string Using " << network_name() << " for evaluation" << std::endl;
 #endif
 			// `go wtime ... btime ... winc ... binc ...`
 			// only care about wtime and btime
@@ -106,6 +208,7 @@ int main(int argc, char *argv[]) {
 			int wtime = 0, btime = 0, winc = 0, binc = 0;
 			int depth = -1;
 			int nodes = -1;
+			int mate = -1;
 			bool inf = false;
 			ss >> token;
 			while (ss >> token) {
@@ -123,12 +226,23 @@ int main(int argc, char *argv[]) {
 					inf = true;
 				} else if (token == "nodes") {
 					ss >> nodes;
+				} else if (token == "mate") {
+					ss >> mate;
 				}
 			}
 			int timeleft = board.side ? btime : wtime;
 			int inc = board.side ? binc : winc;
 			std::pair<Move, Value> res;
-			if (inf)
+			if (mate > 0) {
+				// Prove the mate with the dedicated solver, falling back to a regular search of the same horizon
+				std::pair<Move, int> mres = search_mate(board, mate, ttable.mxsize() * sizeof(TTable::TTEntry) / (1024 * 1024));
+				if (mres.first != NullMove) {
+					std::cout << "bestmove " << mres.first.to_string() << std::endl;
+					continue;
+				}
+				std::cout << "info string no mate in " << mate << " found" << std::endl;
+				res = search_depth(board, 2 * mate - 1);
+			} else if (inf)
 				res = search(board);
 			else if (depth != -1)
 				res = search_depth(board, depth);
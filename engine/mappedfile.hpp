@@ -0,0 +1,97 @@
+#pragma once
+
+#include "includes.hpp"
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * A read-only file mapped into memory, so that large inputs (networks, position lists) can be
+ * used in place without being copied. The data is page aligned.
+ *
+ * Windows builds read the file into an aligned buffer instead.
+ */
+class MappedFile {
+private:
+	static constexpr size_t ALIGN = 4096;
+
+	void *ptr = nullptr;
+	size_t len = 0;
+
+	void release() {
+		if (!ptr)
+			return;
+#ifndef WINDOWS
+		munmap(ptr, len);
+#else
+		operator delete(ptr, std::align_val_t(ALIGN));
+#endif
+		ptr = nullptr;
+		len = 0;
+	}
+
+public:
+	MappedFile() = default;
+
+	~MappedFile() { release(); }
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	MappedFile &operator=(MappedFile &&o) {
+		if (this != &o) {
+			release();
+			std::swap(ptr, o.ptr);
+			std::swap(len, o.len);
+		}
+		return *this;
+	}
+
+	// Map the file at `path`, returns false and fills `error` if it can't be read or is empty
+	bool open(const std::string &path, std::string &error) {
+		release();
+#ifndef WINDOWS
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			error = strerror(errno);
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			error = "empty file";
+			::close(fd);
+			return false;
+		}
+		void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED) {
+			error = strerror(errno);
+			return false;
+		}
+		ptr = data;
+		len = st.st_size;
+#else
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) {
+			error = "cannot open file";
+			return false;
+		}
+		len = file.tellg();
+		if (len == 0) {
+			error = "empty file";
+			return false;
+		}
+		ptr = operator new(len, std::align_val_t(ALIGN));
+		file.seekg(0);
+		file.read((char *)ptr, len);
+#endif
+		return true;
+	}
+
+	const char *data() const { return (const char *)ptr; }
+	size_t size() const { return len; }
+};
@@ -0,0 +1,201 @@
+#include "mate.hpp"
+
+uint64_t pn_nodes = 0; // Node count of the mate solver
+ProofTable *ptable = nullptr; // Proof table of the current solve
+
+ProofTable::PTEntry *ProofTable::probe(uint64_t key) {
+	PTEntry *bucket = PT + (key % PT_SIZE) * 2;
+	if (bucket[0].key == key)
+		return bucket;
+	if (bucket[1].key == key)
+		return bucket + 1;
+	return nullptr;
+}
+
+void ProofTable::store(uint64_t key, uint32_t phi, uint32_t delta, uint32_t work, uint8_t dist) {
+	PTEntry *bucket = PT + (key % PT_SIZE) * 2;
+	PTEntry *entry;
+	if (bucket[0].key == key)
+		entry = bucket;
+	else if (bucket[1].key == key)
+		entry = bucket + 1;
+	else
+		entry = bucket[0].work <= bucket[1].work ? bucket : bucket + 1; // Keep the more expensive entry
+	entry->key = key;
+	entry->phi = phi;
+	entry->delta = delta;
+	entry->work = work;
+	entry->dist = dist;
+}
+
+// A position that is a mate in n is not necessarily a mate in n-1, so the plies left are part of the key
+static inline uint64_t pn_key(const Board &board, int plies) {
+	return board.zobrist ^ ((uint64_t)(plies + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+// Whether the side to move is in check
+static inline bool in_check(const Board &board) {
+	auto control = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(board.side)]));
+	return board.side == WHITE ? control.second : control.first;
+}
+
+// Filters pseudo-legal moves down to those that don't leave our own king in check
+static void pn_legal_moves(Board &board, pzstd::vector<Move> &legal) {
+	pzstd::vector<Move> moves;
+	board.legal_moves(moves);
+	for (Move &move : moves) {
+		board.make_move(move);
+		auto control = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OPPOCC(board.side)]));
+		if (!(board.side == WHITE ? control.first : control.second))
+			legal.push_back(move);
+		board.unmake_move();
+	}
+}
+
+/**
+ * Depth-first proof-number search (df-pn), written in the negamax form.
+ *
+ * For the side to move at a node, phi is the number of leaves that still have to be proven
+ * for that side to reach its goal, and delta the number needed to refute it. The attacker
+ * moves at odd `plies` (OR nodes) and wants mate, while the defender moves at even `plies`
+ * (AND nodes) and wants to survive until `plies` runs out.
+ *
+ * The node is expanded until its phi or delta reaches the given thresholds, always descending
+ * into the child that is cheapest to prove for our side.
+ */
+void __mid(Board &board, int plies, uint32_t thphi, uint32_t thdelta) {
+	pn_nodes++;
+	uint64_t key = pn_key(board, plies);
+	uint64_t start_nodes = pn_nodes;
+
+	pzstd::vector<Move> legal;
+	pn_legal_moves(board, legal);
+
+	if (legal.size() == 0) {
+		if (!(plies & 1) && !in_check(board))
+			ptable->store(key, 0, PN_INFINITE, 1, 0); // Defender is stalemated
+		else
+			ptable->store(key, PN_INFINITE, 0, 1, 0); // Defender is mated, or attacker is mated or stalemated
+		return;
+	}
+	if (plies == 0) {
+		ptable->store(key, 0, PN_INFINITE, 1, 0); // Defender survived
+		return;
+	}
+
+	uint64_t child_keys[PZSTL_MAX_SIZE];
+	for (int i = 0; i < legal.size(); i++) {
+		board.make_move(legal[i]);
+		child_keys[i] = pn_key(board, plies - 1);
+		board.unmake_move();
+	}
+
+	while (true) {
+		uint32_t phi = PN_INFINITE, delta = 0, delta2 = PN_INFINITE, best_phi = 0;
+		uint8_t min_dist = 0xff, max_dist = 0;
+		int best = 0;
+		for (int i = 0; i < legal.size(); i++) {
+			ProofTable::PTEntry *entry = ptable->probe(child_keys[i]);
+			uint32_t cphi = entry ? entry->phi : 1;
+			uint32_t cdelta = entry ? entry->delta : 1;
+			delta = std::min<uint64_t>(PN_INFINITE, (uint64_t)delta + cphi);
+			if (cdelta < phi) {
+				delta2 = phi;
+				phi = cdelta;
+				best = i;
+				best_phi = cphi;
+			} else if (cdelta < delta2) {
+				delta2 = cdelta;
+			}
+			if (entry) {
+				if (cdelta == 0)
+					min_dist = std::min(min_dist, entry->dist);
+				max_dist = std::max(max_dist, entry->dist);
+			}
+		}
+
+		if (phi >= thphi || delta >= thdelta) {
+			// A proven node mates as fast as its fastest winning child, a lost node as slowly as its slowest child
+			uint8_t dist = phi == 0 ? min_dist + 1 : max_dist + 1;
+			ptable->store(key, phi, delta, pn_nodes - start_nodes + 1, dist);
+			return;
+		}
+
+		// Descend into the most proving child, until it is no longer the best or our thresholds are hit
+		uint32_t child_thphi = std::min<uint64_t>(PN_INFINITE, (uint64_t)thdelta - delta + best_phi);
+		uint32_t child_thdelta = std::min<uint64_t>(thphi, (uint64_t)delta2 + 1);
+		board.make_move(legal[best]);
+		__mid(board, plies - 1, child_thphi, child_thdelta);
+		board.unmake_move();
+	}
+}
+
+// Follows the proof from the root: quickest mate for the attacker, longest resistance for the defender
+int __mate_line(Board &board, int plies, Move *pv) {
+	if (plies == 0)
+		return 0;
+	pzstd::vector<Move> legal;
+	pn_legal_moves(board, legal);
+	int best = -1, best_dist = 0;
+	for (int i = 0; i < legal.size(); i++) {
+		board.make_move(legal[i]);
+		ProofTable::PTEntry *entry = ptable->probe(pn_key(board, plies - 1));
+		board.unmake_move();
+		if (!entry)
+			continue;
+		if (plies & 1) {
+			if (entry->delta == 0 && (best == -1 || entry->dist < best_dist)) {
+				best = i;
+				best_dist = entry->dist;
+			}
+		} else {
+			if (entry->phi == 0 && (best == -1 || entry->dist > best_dist)) {
+				best = i;
+				best_dist = entry->dist;
+			}
+		}
+	}
+	if (best == -1)
+		return 0;
+	pv[0] = legal[best];
+	board.make_move(legal[best]);
+	int len = __mate_line(board, plies - 1, pv + 1) + 1;
+	board.unmake_move();
+	return len;
+}
+
+std::pair<Move, int> search_mate(Board &board, int moves, uint64_t mb, bool quiet) {
+	std::cout << std::fixed << std::setprecision(0);
+	ProofTable table(mb);
+	ptable = &table;
+	pn_nodes = 0;
+	clock_t start = clock();
+
+	Move pv[MAX_PLY];
+	std::pair<Move, int> res = {NullMove, 0};
+	moves = std::min(moves, MAX_PLY / 2);
+	// Solve increasing mate lengths so that the first proof found is the shortest one
+	for (int n = 1; n <= moves; n++) {
+		int plies = 2 * n - 1;
+		__mid(board, plies, PN_INFINITE, PN_INFINITE);
+		ProofTable::PTEntry *root = table.probe(pn_key(board, plies));
+		if (!root || root->phi != 0)
+			continue;
+
+		int len = __mate_line(board, plies, pv);
+		if (len == 0)
+			break; // The proof was overwritten in the table, let the caller fall back to a regular search
+		res = {pv[0], n};
+		if (!quiet) {
+			std::cout << "info depth " << plies << " score mate " << n << " nodes " << pn_nodes << " nps "
+					  << (pn_nodes / ((double)(clock() - start + 1) / CLOCKS_PER_SEC)) << " time " << (clock() - start) / CLOCKS_PER_MS << " pv ";
+			for (int i = 0; i < len; i++)
+				std::cout << pv[i].to_string() << ' ';
+			std::cout << std::endl;
+		}
+		break;
+	}
+
+	ptable = nullptr;
+	return res;
+}
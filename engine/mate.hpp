@@ -0,0 +1,48 @@
+#pragma once
+
+#include "bitboard.hpp"
+#include "includes.hpp"
+#include "movegen.hpp"
+
+// Proof and disproof numbers saturate at this value
+#define PN_INFINITE (1u << 30)
+
+/**
+ * Memory-bounded table of proof and disproof numbers for the mate solver.
+ *
+ * Entries are keyed by the position hash mixed with the number of plies left, since a
+ * position that is a mate in 3 may not be a mate in 2. Each slot holds two entries, and
+ * the one that took less work to compute is replaced first.
+ */
+struct ProofTable {
+	struct PTEntry {
+		uint64_t key;
+		uint32_t phi; // Proof number at OR nodes, disproof number at AND nodes
+		uint32_t delta; // Disproof number at OR nodes, proof number at AND nodes
+		uint32_t work; // Number of nodes spent on this entry
+		uint8_t dist; // Plies to mate once proven
+
+		PTEntry() : key(0), phi(1), delta(1), work(0), dist(0) {}
+	};
+
+	PTEntry *PT;
+	uint64_t PT_SIZE;
+
+	ProofTable(uint64_t mb) : PT_SIZE(std::max<uint64_t>(1, mb * 1024 * 1024 / sizeof(PTEntry) / 2)) { PT = new PTEntry[PT_SIZE * 2]; }
+
+	~ProofTable() { delete[] PT; }
+
+	ProofTable(const ProofTable &) = delete;
+	ProofTable &operator=(const ProofTable &) = delete;
+
+	PTEntry *probe(uint64_t key);
+	void store(uint64_t key, uint32_t phi, uint32_t delta, uint32_t work, uint8_t dist);
+};
+
+/**
+ * Find the shortest forced mate in at most `moves` moves for the side to move using df-pn.
+ *
+ * Prints the proven line on success. Returns the first move of the mate and its length in moves,
+ * or {NullMove, 0} if no mate within the limit exists.
+ */
+std::pair<Move, int> search_mate(Board &board, int moves, uint64_t mb = 16, bool quiet = false);
@@ -1,322 +1,349 @@
 #include "movegen.hpp"
+#include "cpu.hpp"
 
 struct MagicEntry {
 	Bitboard mask;
+	Bitboard magic; // Only used when PEXT is unavailable or slow
 	uint32_t offset;
+	uint8_t shift;
+	Bitboard rays; // Every square the slider can reach, which compressed attacks are expanded along
 };
 
-Bitboard knight_movetable[64];
-Bitboard king_movetable[64];
-Bitboard rook_movetable[102400];
-Bitboard bishop_movetable[5248];
-
-MagicEntry rook_magics[64];
-MagicEntry bishop_magics[64];
+// Multipliers that map every subset of a slider's mask to a distinct slot of a table of the
+// size PEXT would use (64 - popcount(mask) bits of shift), so both layouts share the same offsets
+constexpr Bitboard rook_magic_numbers[64] = {
+	0x0280132180004001ULL, 0x0140001000200040ULL, 0x0880200010000880ULL, 0x2080080005801000ULL,
+	0x0200041020080200ULL, 0x0200041041084200ULL, 0x0400080081124410ULL, 0x2180042100004080ULL,
+	0x8000800099644000ULL, 0x0802003040820100ULL, 0x0105801001862000ULL, 0x0101002008100100ULL,
+	0x1000800400080080ULL, 0x0804800200040080ULL, 0x2001800200800900ULL, 0x00160004088204c1ULL,
+	0x228000c001402000ULL, 0x8510004000200050ULL, 0x3001848020029000ULL, 0x0280808010000801ULL,
+	0x0109010010040800ULL, 0x8000808004000200ULL, 0x8000040081021028ULL, 0x40040a0009004884ULL,
+	0x80c0004280008035ULL, 0x0010004040002000ULL, 0x1101200500410070ULL, 0x8410100080080080ULL,
+	0x000c080080800400ULL, 0x4012008080040002ULL, 0x4000040101000200ULL, 0x0061010200008044ULL,
+	0x0080804010800020ULL, 0x3000201008400040ULL, 0x4112008012002444ULL, 0x0848000880801000ULL,
+	0x00a8008008800400ULL, 0x200200280a00500cULL, 0x080a221024004801ULL, 0xc400008042000104ULL,
+	0x8000400080028022ULL, 0x0220008040018020ULL, 0x4000200011010040ULL, 0x10060040210a0010ULL,
+	0x40820020904a0004ULL, 0x0030040002008080ULL, 0x0200020801840010ULL, 0x0084c04100820004ULL,
+	0x4802010080c2a600ULL, 0x0000400080201880ULL, 0x2040801000200080ULL, 0x0180200842001200ULL,
+	0x0013510008000500ULL, 0x0182000c00808a80ULL, 0x1000524821302400ULL, 0x3800040108488200ULL,
+	0x104a004810210082ULL, 0x0004210010420082ULL, 0xc424110008200241ULL, 0x90101000a0088501ULL,
+	0x0182000420100802ULL, 0x4822001001080402ULL, 0x05d0080090012204ULL, 0x2008140089042846ULL,
+};
 
-void gen_rook_moves(int sq, Bitboard piece) {
-	Bitboard board = 0;
-	int idx = 0;
-	Bitboard rank = 0x00000000000000ff;
-	Bitboard file = 0x0101010101010101;
-	uint32_t offset;
-	if (sq == 0)
-		offset = 0;
-	else
-		offset = rook_magics[sq].offset;
-	do {
-		// Generate moves for this board (bitwise magic don't ask)
-		Bitboard rankray = rank << (sq & 0b111000);
-		Bitboard fileray = file << (sq & 0b111);
-
-		Bitboard moves = 0;
-		Bitboard west = rankray & (piece - 1);
-		if (west & board)
-			moves |= west & ~((1LL << (63 - _lzcnt_u64(west & board))) - 1);
-		else
-			moves |= west;
-		Bitboard south = fileray & (piece - 1);
-		if (south & board)
-			moves |= south & ~((1LL << (63 - _lzcnt_u64(south & board))) - 1);
-		else
-			moves |= south;
-		Bitboard east = rankray ^ west ^ piece;
-		moves |= east & _blsmsk_u64(east & board);
-		Bitboard north = fileray ^ south ^ piece;
-		moves |= north & _blsmsk_u64(north & board);
-
-		rook_movetable[offset + idx] = moves;
-		// Prepare next board (this works i promise)
-		board = (board - rook_magics[sq].mask) & rook_magics[sq].mask;
-		idx++;
-	} while (board);
-	if (sq != 63)
-		rook_magics[sq + 1].offset = offset + idx;
-}
-
-void gen_bishop_moves(int sq, Bitboard piece) {
-	Bitboard board = 0;
-	int idx = 0;
-	Bitboard diag = 0x8040201008040201;
-	Bitboard anti_diag = 0x0102040810204080;
-	uint32_t offset;
-	if (sq == 0)
-		offset = 0;
-	else
-		offset = bishop_magics[sq].offset;
-	do {
-		// Generate moves for this board (bitwise magic don't ask)
-		int shift = (sq & 0b111) - (sq >> 3);
-		Bitboard diagray;
-		if (shift >= 0)
-			diagray = (diag >> (shift * 8));
-		else
-			diagray = (diag << (-shift * 8));
-		Bitboard antiray;
-		shift = 7 - (sq & 0b111) - (sq >> 3);
-		if (shift >= 0)
-			antiray = (anti_diag >> (shift * 8));
-		else
-			antiray = (anti_diag << (-shift * 8));
+constexpr Bitboard bishop_magic_numbers[64] = {
+	0x0420220228022c80ULL, 0x200208010c108000ULL, 0x1004010411040040ULL, 0x12a4040292002440ULL,
+	0x0804042082000850ULL, 0x0802020220010440ULL, 0x800401048260201aULL, 0x0041010800828800ULL,
+	0x4040641488080104ULL, 0x20002004016e0020ULL, 0x0c2c223a12420042ULL, 0x0100024081020220ULL,
+	0x0383211041025080ULL, 0x08c0030420160600ULL, 0x0c1000510808c00aULL, 0x40501a0084140280ULL,
+	0x40280040112c0088ULL, 0x4020040908110050ULL, 0x1028001008801412ULL, 0x0104220202020000ULL,
+	0x800a000400940010ULL, 0x0401000200512410ULL, 0x1082012100900408ULL, 0x0101402208440c00ULL,
+	0x00482104c01c1111ULL, 0x0310105008017101ULL, 0x0022010108080020ULL, 0x02300400104010a0ULL,
+	0x1401010011444000ULL, 0x1001020000405020ULL, 0x00010a0804480411ULL, 0x0419220010404400ULL,
+	0x0010020a00200820ULL, 0xa008280909040104ULL, 0x0210209010080020ULL, 0x3006110800040040ULL,
+	0x0800820200440090ULL, 0x0008100421810080ULL, 0x0028060093264800ULL, 0x0a08004088810080ULL,
+	0x3611100290442000ULL, 0x0241081282001001ULL, 0x11081108010d0800ULL, 0x002a102014420800ULL,
+	0x480002600a004500ULL, 0x8001010102000100ULL, 0x2008080810410883ULL, 0x0002080901101022ULL,
+	0x2800942420444080ULL, 0x2000840108024000ULL, 0x0000804844100040ULL, 0x1444120020884540ULL,
+	0x0004001002020c00ULL, 0x041041c801010049ULL, 0x0060045000850810ULL, 0x1003240c14820208ULL,
+	0x3010104a10100800ULL, 0x0280020101580200ULL, 0x1000000101081600ULL, 0x0644009800420200ULL,
+	0x0050040008102402ULL, 0x00000004601c8106ULL, 0x00088530040812a0ULL, 0x800218010102020cULL,
+};
 
-		Bitboard moves = 0;
-		Bitboard sw = diagray & (piece - 1);
-		if (sw & board)
-			moves |= sw & ~((1LL << (63 - _lzcnt_u64(sw & board))) - 1);
-		else
-			moves |= sw;
-		Bitboard se = antiray & (piece - 1);
-		if (se & board)
-			moves |= se & ~((1LL << (63 - _lzcnt_u64(se & board))) - 1);
-		else
-			moves |= se;
-		Bitboard ne = diagray ^ sw ^ piece;
-		moves |= ne & _blsmsk_u64(ne & board);
-		Bitboard nw = antiray ^ se ^ piece;
-		moves |= nw & _blsmsk_u64(nw & board);
+// Every ray from every square, towards NE, NW, SE, SW for bishops and N, S, E, W for rooks
+struct RayTable {
+	Bitboard rays[2][4][64];
+
+	constexpr RayTable() : rays() {
+		constexpr int dirs[2][4][2] = {{{1, 1}, {-1, 1}, {1, -1}, {-1, -1}}, {{0, 1}, {0, -1}, {1, 0}, {-1, 0}}};
+		for (int rook = 0; rook < 2; rook++) {
+			for (int d = 0; d < 4; d++) {
+				for (int sq = 0; sq < 64; sq++) {
+					int file = (sq & 0b111) + dirs[rook][d][0], rank = (sq >> 3) + dirs[rook][d][1];
+					for (; file >= 0 && file < 8 && rank >= 0 && rank < 8; file += dirs[rook][d][0], rank += dirs[rook][d][1])
+						rays[rook][d][sq] |= 1ULL << (rank * 8 + file);
+				}
+			}
+		}
+	}
+};
 
-		bishop_movetable[offset + idx] = moves;
-		// Prepare next board (this works i promise)
-		board = (board - bishop_magics[sq].mask) & bishop_magics[sq].mask;
-		idx++;
-	} while (board);
-	if (sq != 63)
-		bishop_magics[sq + 1].offset = offset + idx;
+constexpr RayTable RAYS;
+
+// Squares a slider on `sq` attacks, every ray up to and including its first blocker
+// The rays are cut at the blocker closest to `sq`, the lowest one for rays that go up the board
+template <bool Rook> constexpr Bitboard slider_rays(int sq, Bitboard occ) {
+	Bitboard attacks = 0;
+	for (int d = 0; d < 4; d++) {
+		Bitboard ray = RAYS.rays[Rook][d][sq];
+		Bitboard blockers = ray & occ;
+		if (blockers)
+			ray ^= RAYS.rays[Rook][d][ray > (1ULL << sq) ? __builtin_ctzll(blockers) : 63 - __builtin_clzll(blockers)];
+		attacks |= ray;
+	}
+	return attacks;
 }
 
-// This function is called before main()
-__attribute__((constructor)) void init_movetables() {
-	// Initialize trivial bitboards
-	Bitboard rank = 0x00000000000000ff;
-	Bitboard file = 0x0101010101010101;
-	Bitboard diag = 0x8040201008040201;
-	Bitboard anti_diag = 0x0102040810204080;
-	Bitboard piece = square_bits(SQ_A1);
-	for (int i = 0; piece; piece <<= 1, i++) {
-		// Knight
-		Bitboard hor1 = ((piece & ~FileHBits) << 1) | ((piece & ~FileABits) >> 1);
-		Bitboard hor2 = ((piece & ~FileHBits & ~FileGBits) << 2) | ((piece & ~FileABits & ~FileBBits) >> 2);
-		knight_movetable[i] = (hor1 << 16) | (hor1 >> 16) | (hor2 << 8) | (hor2 >> 8);
-
-		// King
-		Bitboard king = hor1 | piece;
-		king_movetable[i] = (king | (king << 8) | (king >> 8)) ^ piece;
-
-		// Create mask for rook
-		Bitboard mask = (rank << (i & 0b111000)) ^ (file << (i & 0b111)); // XOR gets rid of the square itself
-		// Remove squares on the edges (irrelevant for rook moves)
-		if ((i & 0b111) != FILE_A)
-			mask &= ~FileABits;
-		if ((i >> 3) != RANK_1)
-			mask &= ~Rank1Bits;
-		if ((i & 0b111) != FILE_H)
-			mask &= ~FileHBits;
-		if ((i >> 3) != RANK_8)
-			mask &= ~Rank8Bits;
-		rook_magics[i].mask = mask;
-		gen_rook_moves(i, piece);
-
-		// Create mask for bishop
-		int shift = (i & 0b111) - (i >> 3);
-		if (shift >= 0)
-			mask = (diag >> (shift * 8));
-		else
-			mask = (diag << (-shift * 8));
-		shift = 7 - (i & 0b111) - (i >> 3);
-		if (shift >= 0)
-			mask ^= (anti_diag >> (shift * 8));
-		else
-			mask ^= (anti_diag << (-shift * 8));
-		// Remove squares on the edges (irrelevant for bishop moves)
-		if ((i & 0b111) != FILE_A)
-			mask &= ~FileABits;
-		if ((i >> 3) != RANK_1)
-			mask &= ~Rank1Bits;
-		if ((i & 0b111) != FILE_H)
-			mask &= ~FileHBits;
-		if ((i >> 3) != RANK_8)
-			mask &= ~Rank8Bits;
-		bishop_magics[i].mask = mask;
-		gen_bishop_moves(i, piece);
+// The squares whose occupancy matters to a slider on `sq`: its rays without the edges they run into
+template <bool Rook> constexpr Bitboard slider_mask(int sq) {
+	Bitboard mask = 0;
+	for (int d = 0; d < 4; d++) {
+		Bitboard ray = RAYS.rays[Rook][d][sq];
+		if (ray)
+			ray ^= 1ULL << (ray > (1ULL << sq) ? 63 - __builtin_clzll(ray) : __builtin_ctzll(ray)); // The edge square
+		mask |= ray;
 	}
+	return mask;
 }
 
-void white_pawn_moves(const Board &board, pzstd::vector<Move> &moves) {
-	Bitboard pieces = board.piece_boards[PAWN] & board.piece_boards[OCC(WHITE)];
-	Bitboard dsts;
-	// En passant
-	if (board.ep_square != SQ_NONE) {
-		dsts = ((pieces & ~FileABits & Rank5Bits) << 7) & square_bits(board.ep_square);
-		while (dsts) {
-			int sq = _tzcnt_u64(dsts);
-			moves.push_back(Move::make<EN_PASSANT>(sq - 7, sq));
-			dsts = _blsr_u64(dsts);
-		}
-		dsts = ((pieces & ~FileHBits & Rank5Bits) << 9) & square_bits(board.ep_square);
-		while (dsts) {
-			int sq = _tzcnt_u64(dsts);
-			moves.push_back(Move::make<EN_PASSANT>(sq - 9, sq));
-			dsts = _blsr_u64(dsts);
+// Masks, magics and table offsets of every square, each square taking 2^popcount(mask) slots
+template <bool Rook> struct MagicTable {
+	MagicEntry entries[64];
+	uint32_t size;
+
+	constexpr MagicTable() : entries(), size(0) {
+		for (int sq = 0; sq < 64; sq++) {
+			Bitboard mask = slider_mask<Rook>(sq);
+			int bits = __builtin_popcountll(mask);
+			entries[sq] = {mask, Rook ? rook_magic_numbers[sq] : bishop_magic_numbers[sq], size, uint8_t(64 - bits), slider_rays<Rook>(sq, 0)};
+			size += 1 << bits;
 		}
 	}
-	// Promotion
-	dsts = ((pieces & Rank7Bits) << 8) & ~(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
-	while (dsts) {
-		int sq = _tzcnt_u64(dsts);
-		moves.push_back(Move::make<PROMOTION>(sq - 8, sq, QUEEN));
-		moves.push_back(Move::make<PROMOTION>(sq - 8, sq, ROOK));
-		moves.push_back(Move::make<PROMOTION>(sq - 8, sq, KNIGHT));
-		moves.push_back(Move::make<PROMOTION>(sq - 8, sq, BISHOP));
-		dsts = _blsr_u64(dsts);
+
+	constexpr const MagicEntry &operator[](int sq) const { return entries[sq]; }
+};
+
+constexpr MagicTable<true> rook_magics;
+constexpr MagicTable<false> bishop_magics;
+
+/**
+ * With -DCOMPRESSED_SLIDERS, the PEXT-ordered tables hold the attacks compressed to 16 bits
+ * along the slider's rays (at most 14 squares for a rook), which are expanded again with PDEP.
+ * That makes them a quarter of the size (~215 KB instead of ~860 KB), so that they compete less
+ * with the network and the TT for cache, at the cost of a PDEP per lookup. Like PEXT, PDEP is
+ * only fast where use_pext is set, so the magic fallback keeps full bitboards.
+ */
+#ifdef COMPRESSED_SLIDERS
+typedef uint16_t SliderAttacks;
+#else
+typedef Bitboard SliderAttacks;
+#endif
+
+constexpr uint64_t soft_pext(uint64_t src, uint64_t mask) {
+	uint64_t dst = 0;
+	for (uint64_t bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+		if (src & mask & -mask)
+			dst |= bit;
 	}
-	// Captures
-	dsts = ((pieces & ~FileABits) << 7) & board.piece_boards[OCC(BLACK)];
-	while (dsts) {
-		int sq = _tzcnt_u64(dsts);
-		if (sq >= SQ_A8) {
-			moves.push_back(Move::make<PROMOTION>(sq - 7, sq, QUEEN));
-			moves.push_back(Move::make<PROMOTION>(sq - 7, sq, ROOK));
-			moves.push_back(Move::make<PROMOTION>(sq - 7, sq, KNIGHT));
-			moves.push_back(Move::make<PROMOTION>(sq - 7, sq, BISHOP));
-		} else {
-			moves.push_back(Move(sq - 7, sq));
-		}
-		dsts = _blsr_u64(dsts);
+	return dst;
+}
+
+constexpr uint64_t soft_pdep(uint64_t src, uint64_t mask) {
+	uint64_t dst = 0;
+	for (uint64_t bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+		if (src & bit)
+			dst |= mask & -mask;
 	}
-	dsts = ((pieces & ~FileHBits) << 9) & board.piece_boards[OCC(BLACK)];
-	while (dsts) {
-		int sq = _tzcnt_u64(dsts);
-		if (sq >= SQ_A8) {
-			moves.push_back(Move::make<PROMOTION>(sq - 9, sq, QUEEN));
-			moves.push_back(Move::make<PROMOTION>(sq - 9, sq, ROOK));
-			moves.push_back(Move::make<PROMOTION>(sq - 9, sq, KNIGHT));
-			moves.push_back(Move::make<PROMOTION>(sq - 9, sq, BISHOP));
-		} else {
-			moves.push_back(Move(sq - 9, sq));
+	return dst;
+}
+
+// Slider attacks in PEXT order, which is the order the carry-rippler trick enumerates the subsets
+// of a mask in, i.e. the attacks for `occ` are at offset + pext(occ, mask)
+template <uint32_t Size, bool Rook> struct SliderTable {
+	SliderAttacks table[Size];
+
+	constexpr SliderTable(const MagicTable<Rook> &magics) : table() {
+		for (int sq = 0; sq < 64; sq++) {
+			Bitboard mask = magics[sq].mask, occ = 0;
+			uint32_t idx = magics[sq].offset;
+			do {
+#ifdef COMPRESSED_SLIDERS
+				table[idx++] = soft_pext(slider_rays<Rook>(sq, occ), magics[sq].rays);
+#else
+				table[idx++] = slider_rays<Rook>(sq, occ);
+#endif
+				occ = (occ - mask) & mask; // Next subset (this works i promise)
+			} while (occ);
 		}
-		dsts = _blsr_u64(dsts);
 	}
-	// Normal single pushes (no promotion)
-	dsts = ((pieces & ~Rank7Bits) << 8) & ~(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
-	Bitboard tmp = dsts;
-	while (tmp) {
-		int sq = _tzcnt_u64(tmp);
-		moves.push_back(Move(sq - 8, sq));
-		tmp = _blsr_u64(tmp);
+};
+
+static_assert(rook_magics.size == 102400 && bishop_magics.size == 5248, "slider tables have the wrong size");
+constexpr SliderTable<102400, true> rook_pext_table(rook_magics);
+constexpr SliderTable<5248, false> bishop_pext_table(bishop_magics);
+
+// The same attacks in magic order, only filled in when PEXT is unavailable or slow
+Bitboard rook_magic_table[102400];
+Bitboard bishop_magic_table[5248];
+
+// Whether slider lookups index with PEXT (decided once at startup, see cpu.hpp)
+bool use_pext = false;
+// Whether set-wise slider attacks use the AVX2 fill (also decided at startup)
+bool use_avx2 = false;
+
+inline uint64_t pext(uint64_t src, uint64_t mask) {
+#ifdef __BMI2__
+	return _pext_u64(src, mask);
+#else
+	// Portable builds aren't allowed to emit BMI2 on their own, but use_pext says it's there
+	uint64_t dst;
+	asm("pextq %2, %1, %0" : "=r"(dst) : "r"(src), "r"(mask));
+	return dst;
+#endif
+}
+
+#ifdef COMPRESSED_SLIDERS
+inline uint64_t pdep(uint64_t src, uint64_t mask) {
+#ifdef __BMI2__
+	return _pdep_u64(src, mask);
+#else
+	uint64_t dst;
+	asm("pdepq %2, %1, %0" : "=r"(dst) : "r"(src), "r"(mask));
+	return dst;
+#endif
+}
+#endif
+
+inline uint32_t magic_index(const MagicEntry &entry, Bitboard occ) {
+	return entry.offset + (((occ & entry.mask) * entry.magic) >> entry.shift);
+}
+
+// Attacks of a slider for the occupancy `occ`, from whichever table layout is in use
+inline Bitboard slider_attacks(const MagicEntry &entry, const SliderAttacks *pext_table, const Bitboard *magic_table, Bitboard occ) {
+	if (use_pext) {
+#ifdef COMPRESSED_SLIDERS
+		return pdep(pext_table[entry.offset + pext(occ, entry.mask)], entry.rays);
+#else
+		return pext_table[entry.offset + pext(occ, entry.mask)];
+#endif
 	}
-	// Double pushes
-	dsts = ((dsts & Rank3Bits) << 8) & ~(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
-	while (dsts) {
-		int sq = _tzcnt_u64(dsts);
-		moves.push_back(Move(sq - 16, sq));
-		dsts = _blsr_u64(dsts);
+	return magic_table[magic_index(entry, occ)];
+}
+
+inline Bitboard rook_lookup(int sq, Bitboard occ) {
+	return slider_attacks(rook_magics[sq], rook_pext_table.table, rook_magic_table, occ);
+}
+
+inline Bitboard bishop_lookup(int sq, Bitboard occ) {
+	return slider_attacks(bishop_magics[sq], bishop_pext_table.table, bishop_magic_table, occ);
+}
+
+// Copies a PEXT-ordered table into magic order
+template <bool Rook> void gen_magic_table(const MagicTable<Rook> &magics, const SliderAttacks *pext_table, Bitboard *magic_table) {
+	for (int sq = 0; sq < 64; sq++) {
+		Bitboard mask = magics[sq].mask, occ = 0;
+		uint32_t idx = magics[sq].offset;
+		do {
+#ifdef COMPRESSED_SLIDERS
+			magic_table[magic_index(magics[sq], occ)] = soft_pdep(pext_table[idx++], magics[sq].rays);
+#else
+			magic_table[magic_index(magics[sq], occ)] = pext_table[idx++];
+#endif
+			occ = (occ - mask) & mask;
+		} while (occ);
 	}
 }
 
-void black_pawn_moves(const Board &board, pzstd::vector<Move> &moves) {
-	Bitboard pieces = board.piece_boards[PAWN] & board.piece_boards[OCC(BLACK)];
+// This function is called before main()
+__attribute__((constructor)) void init_movetables() {
+	use_avx2 = cpu_features().avx2;
+	use_pext = cpu_features().fast_pext;
+	if (use_pext)
+		return;
+	gen_magic_table(rook_magics, rook_pext_table.table, rook_magic_table);
+	gen_magic_table(bishop_magics, bishop_pext_table.table, bishop_magic_table);
+}
+
+// Shifts a bitboard towards the given direction (positive is towards the 8th rank)
+template <int D> constexpr Bitboard shift(Bitboard b) {
+	return D > 0 ? b << D : b >> -D;
+}
+
+// Adds the four promotion moves from `src` to `dst`
+inline void push_promotions(pzstd::vector<Move> &moves, int src, int dst) {
+	moves.push_back(Move::make<PROMOTION>(src, dst, QUEEN));
+	moves.push_back(Move::make<PROMOTION>(src, dst, ROOK));
+	moves.push_back(Move::make<PROMOTION>(src, dst, KNIGHT));
+	moves.push_back(Move::make<PROMOTION>(src, dst, BISHOP));
+}
+
+template <bool Side> void pawn_moves(const Board &board, pzstd::vector<Move> &moves) {
+	// Directions and ranks as seen from the side to move, all resolved at compile time
+	constexpr int Up = Side == WHITE ? 8 : -8;
+	constexpr int Left = Side == WHITE ? 7 : -7; // Capture towards the A file for white, H file for black
+	constexpr int Right = Side == WHITE ? 9 : -9;
+	constexpr Bitboard LeftFile = Side == WHITE ? FileABits : FileHBits;
+	constexpr Bitboard RightFile = Side == WHITE ? FileHBits : FileABits;
+	constexpr Bitboard EPRank = Side == WHITE ? Rank5Bits : Rank4Bits;
+	constexpr Bitboard PromoRank = Side == WHITE ? Rank7Bits : Rank2Bits;
+	constexpr Bitboard LastRank = Side == WHITE ? Rank8Bits : Rank1Bits;
+	constexpr Bitboard DoubleRank = Side == WHITE ? Rank3Bits : Rank6Bits;
+
+	Bitboard pieces = board.piece_boards[PAWN] & board.piece_boards[OCC(Side)];
+	Bitboard empty = ~(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
 	Bitboard dsts;
 	// En passant
 	if (board.ep_square != SQ_NONE) {
-		dsts = ((pieces & ~FileHBits & Rank4Bits) >> 7) & square_bits(board.ep_square);
+		dsts = shift<Left>(pieces & ~LeftFile & EPRank) & square_bits(board.ep_square);
 		while (dsts) {
 			int sq = _tzcnt_u64(dsts);
-			moves.push_back(Move::make<EN_PASSANT>(sq + 7, sq));
+			moves.push_back(Move::make<EN_PASSANT>(sq - Left, sq));
 			dsts = _blsr_u64(dsts);
 		}
-		dsts = ((pieces & ~FileABits & Rank4Bits) >> 9) & square_bits(board.ep_square);
+		dsts = shift<Right>(pieces & ~RightFile & EPRank) & square_bits(board.ep_square);
 		while (dsts) {
 			int sq = _tzcnt_u64(dsts);
-			moves.push_back(Move::make<EN_PASSANT>(sq + 9, sq));
+			moves.push_back(Move::make<EN_PASSANT>(sq - Right, sq));
 			dsts = _blsr_u64(dsts);
 		}
 	}
 	// Promotion
-	dsts = ((pieces & Rank2Bits) >> 8) & ~(board.piece_boards[OCC(BLACK)] | board.piece_boards[OCC(WHITE)]);
+	dsts = shift<Up>(pieces & PromoRank) & empty;
 	while (dsts) {
 		int sq = _tzcnt_u64(dsts);
-		moves.push_back(Move::make<PROMOTION>(sq + 8, sq, QUEEN));
-		moves.push_back(Move::make<PROMOTION>(sq + 8, sq, ROOK));
-		moves.push_back(Move::make<PROMOTION>(sq + 8, sq, KNIGHT));
-		moves.push_back(Move::make<PROMOTION>(sq + 8, sq, BISHOP));
+		push_promotions(moves, sq - Up, sq);
 		dsts = _blsr_u64(dsts);
 	}
 	// Captures
-	dsts = ((pieces & ~FileHBits) >> 7) & board.piece_boards[OCC(WHITE)];
+	dsts = shift<Left>(pieces & ~LeftFile) & board.piece_boards[OPPOCC(Side)];
 	while (dsts) {
 		int sq = _tzcnt_u64(dsts);
-		if (sq <= SQ_H1) {
-			moves.push_back(Move::make<PROMOTION>(sq + 7, sq, QUEEN));
-			moves.push_back(Move::make<PROMOTION>(sq + 7, sq, ROOK));
-			moves.push_back(Move::make<PROMOTION>(sq + 7, sq, KNIGHT));
-			moves.push_back(Move::make<PROMOTION>(sq + 7, sq, BISHOP));
-		} else {
-			moves.push_back(Move(sq + 7, sq));
-		}
+		if (square_bits(Square(sq)) & LastRank)
+			push_promotions(moves, sq - Left, sq);
+		else
+			moves.push_back(Move(sq - Left, sq));
 		dsts = _blsr_u64(dsts);
 	}
-	dsts = ((pieces & ~FileABits) >> 9) & board.piece_boards[OCC(WHITE)];
+	dsts = shift<Right>(pieces & ~RightFile) & board.piece_boards[OPPOCC(Side)];
 	while (dsts) {
 		int sq = _tzcnt_u64(dsts);
-		if (sq <= SQ_H1) {
-			moves.push_back(Move::make<PROMOTION>(sq + 9, sq, QUEEN));
-			moves.push_back(Move::make<PROMOTION>(sq + 9, sq, ROOK));
-			moves.push_back(Move::make<PROMOTION>(sq + 9, sq, KNIGHT));
-			moves.push_back(Move::make<PROMOTION>(sq + 9, sq, BISHOP));
-		} else {
-			moves.push_back(Move(sq + 9, sq));
-		}
+		if (square_bits(Square(sq)) & LastRank)
+			push_promotions(moves, sq - Right, sq);
+		else
+			moves.push_back(Move(sq - Right, sq));
 		dsts = _blsr_u64(dsts);
 	}
 	// Normal single pushes (no promotion)
-	dsts = ((pieces & ~Rank2Bits) >> 8) & ~(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
+	dsts = shift<Up>(pieces & ~PromoRank) & empty;
 	Bitboard tmp = dsts;
 	while (tmp) {
 		int sq = _tzcnt_u64(tmp);
-		moves.push_back(Move(sq + 8, sq));
+		moves.push_back(Move(sq - Up, sq));
 		tmp = _blsr_u64(tmp);
 	}
 	// Double pushes
-	dsts = ((dsts & Rank6Bits) >> 8) & ~(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]);
+	dsts = shift<Up>(dsts & DoubleRank) & empty;
 	while (dsts) {
 		int sq = _tzcnt_u64(dsts);
-		moves.push_back(Move(sq + 16, sq));
+		moves.push_back(Move(sq - 2 * Up, sq));
 		dsts = _blsr_u64(dsts);
 	}
 }
 
-void pawn_moves(const Board &board, pzstd::vector<Move> &moves) {
-	if (board.side == WHITE) {
-		white_pawn_moves(board, moves);
-	} else {
-		black_pawn_moves(board, moves);
-	}
-}
-
-void knight_moves(const Board &board, pzstd::vector<Move> &moves) {
-	Bitboard pieces = board.piece_boards[KNIGHT] & board.piece_boards[OCC(board.side)];
+template <bool Side> void knight_moves(const Board &board, pzstd::vector<Move> &moves) {
+	Bitboard pieces = board.piece_boards[KNIGHT] & board.piece_boards[OCC(Side)];
 	while (pieces) {
 		int sq = _tzcnt_u64(pieces);
-		Bitboard dsts = knight_movetable[sq] & ~board.piece_boards[OCC(board.side)];
+		Bitboard dsts = knight_movetable[sq] & ~board.piece_boards[OCC(Side)];
 		while (dsts) {
 			int dst = _tzcnt_u64(dsts);
 			moves.push_back(Move(sq, dst));
@@ -326,12 +353,11 @@ void knight_moves(const Board &board, pzstd::vector<Move> &moves) {
 	}
 }
 
-void bishop_moves(const Board &board, pzstd::vector<Move> &moves) {
-	Bitboard pieces = (board.piece_boards[BISHOP] | board.piece_boards[QUEEN]) & board.piece_boards[OCC(board.side)];
+template <bool Side> void bishop_moves(const Board &board, pzstd::vector<Move> &moves) {
+	Bitboard pieces = (board.piece_boards[BISHOP] | board.piece_boards[QUEEN]) & board.piece_boards[OCC(Side)];
 	while (pieces) {
 		int sq = _tzcnt_u64(pieces);
-		uint32_t idx = bishop_magics[sq].offset + _pext_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)], bishop_magics[sq].mask);
-		Bitboard dsts = bishop_movetable[idx] & ~board.piece_boards[OCC(board.side)];
+		Bitboard dsts = bishop_lookup(sq, board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) & ~board.piece_boards[OCC(Side)];
 		while (dsts) {
 			int dst = _tzcnt_u64(dsts);
 			moves.push_back(Move(sq, dst));
@@ -341,12 +367,11 @@ void bishop_moves(const Board &board, pzstd::vector<Move> &moves) {
 	}
 }
 
-void rook_moves(const Board &board, pzstd::vector<Move> &moves) {
-	Bitboard pieces = (board.piece_boards[ROOK] | board.piece_boards[QUEEN]) & board.piece_boards[OCC(board.side)];
+template <bool Side> void rook_moves(const Board &board, pzstd::vector<Move> &moves) {
+	Bitboard pieces = (board.piece_boards[ROOK] | board.piece_boards[QUEEN]) & board.piece_boards[OCC(Side)];
 	while (pieces) {
 		int sq = _tzcnt_u64(pieces);
-		uint32_t idx = rook_magics[sq].offset + _pext_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)], rook_magics[sq].mask);
-		Bitboard dsts = rook_movetable[idx] & ~board.piece_boards[OCC(board.side)];
+		Bitboard dsts = rook_lookup(sq, board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) & ~board.piece_boards[OCC(Side)];
 		while (dsts) {
 			int dst = _tzcnt_u64(dsts);
 			moves.push_back(Move(sq, dst));
@@ -356,36 +381,35 @@ void rook_moves(const Board &board, pzstd::vector<Move> &moves) {
 	}
 }
 
-void king_moves(const Board &board, pzstd::vector<Move> &moves) {
-	Bitboard piece = board.piece_boards[KING] & board.piece_boards[OCC(board.side)];
+template <bool Side> void king_moves(const Board &board, pzstd::vector<Move> &moves) {
+	// Castling squares as seen from the side to move
+	constexpr Square E = Side == WHITE ? SQ_E1 : SQ_E8;
+	constexpr Square F = Side == WHITE ? SQ_F1 : SQ_F8;
+	constexpr Square G = Side == WHITE ? SQ_G1 : SQ_G8;
+	constexpr Square D = Side == WHITE ? SQ_D1 : SQ_D8;
+	constexpr Square C = Side == WHITE ? SQ_C1 : SQ_C8;
+	constexpr Square B = Side == WHITE ? SQ_B1 : SQ_B8;
+	constexpr uint8_t OO = Side == WHITE ? WHITE_OO : BLACK_OO;
+	constexpr uint8_t OOO = Side == WHITE ? WHITE_OOO : BLACK_OOO;
+	Bitboard piece = board.piece_boards[KING] & board.piece_boards[OCC(Side)];
 	if (__builtin_expect(piece == 0, false))
 		return;
 	int sq = _tzcnt_u64(piece);
-	// Castling
-	if (board.side == WHITE && !board.control(SQ_E1).second) {
-		if (board.castling & WHITE_OO) {
-			if (!((board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) & (square_bits(SQ_F1) | square_bits(SQ_G1))) &&
-				!board.control(SQ_F1).second)
-				moves.push_back(Move::make<CASTLING>(SQ_E1, SQ_G1));
-		}
-		if (board.castling & WHITE_OOO) {
-			if (!((board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) & (square_bits(SQ_D1) | square_bits(SQ_C1) | square_bits(SQ_B1))) &&
-				!board.control(SQ_D1).second)
-				moves.push_back(Move::make<CASTLING>(SQ_E1, SQ_C1));
+	Bitboard occ = board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)];
+	// Castling, with every square the opponent attacks found at once
+	Bitboard attacked = (board.castling & (OO | OOO)) ? board.attacks_by(!Side) : 0;
+	if ((board.castling & (OO | OOO)) && !(attacked & square_bits(E))) {
+		if (board.castling & OO) {
+			if (!(occ & (square_bits(F) | square_bits(G))) && !(attacked & square_bits(F)))
+				moves.push_back(Move::make<CASTLING>(E, G));
 		}
-	} else if (board.side == BLACK && !board.control(SQ_E8).first) {
-		if (board.castling & BLACK_OO) {
-			if (!((board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) & (square_bits(SQ_F8) | square_bits(SQ_G8))) && !board.control(SQ_F8).first)
-				moves.push_back(Move::make<CASTLING>(SQ_E8, SQ_G8));
-		}
-		if (board.castling & BLACK_OOO) {
-			if (!((board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) & (square_bits(SQ_D8) | square_bits(SQ_C8) | square_bits(SQ_B8))) &&
-				!board.control(SQ_D8).first)
-				moves.push_back(Move::make<CASTLING>(SQ_E8, SQ_C8));
+		if (board.castling & OOO) {
+			if (!(occ & (square_bits(D) | square_bits(C) | square_bits(B))) && !(attacked & square_bits(D)))
+				moves.push_back(Move::make<CASTLING>(E, C));
 		}
 	}
 	// Normal moves
-	Bitboard dsts = king_movetable[sq] & ~board.piece_boards[OCC(board.side)];
+	Bitboard dsts = king_movetable[sq] & ~board.piece_boards[OCC(Side)];
 	while (dsts) {
 		int dst = _tzcnt_u64(dsts);
 		moves.push_back(Move(sq, dst));
@@ -393,25 +417,32 @@ void king_moves(const Board &board, pzstd::vector<Move> &moves) {
 	}
 }
 
+template <bool Side> void legal_moves(const Board &board, pzstd::vector<Move> &moves) {
+	rook_moves<Side>(board, moves);
+	bishop_moves<Side>(board, moves);
+	knight_moves<Side>(board, moves);
+	pawn_moves<Side>(board, moves);
+	king_moves<Side>(board, moves);
+}
+
 void Board::legal_moves(pzstd::vector<Move> &moves) const {
-	rook_moves(*this, moves);
-	bishop_moves(*this, moves);
-	knight_moves(*this, moves);
-	pawn_moves(*this, moves);
-	king_moves(*this, moves);
+	if (side == WHITE)
+		::legal_moves<WHITE>(*this, moves);
+	else
+		::legal_moves<BLACK>(*this, moves);
 }
 
 std::pair<int, int> Board::control(int sq) const {
 	int white = 0;
 	int black = 0;
 
-	uint32_t idx = rook_magics[sq].offset + _pext_u64(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)], rook_magics[sq].mask);
-	white += _mm_popcnt_u64(rook_movetable[idx] & (piece_boards[ROOK] | piece_boards[QUEEN]) & piece_boards[OCC(WHITE)]);
-	black += _mm_popcnt_u64(rook_movetable[idx] & (piece_boards[ROOK] | piece_boards[QUEEN]) & piece_boards[OCC(BLACK)]);
+	Bitboard attacks = rook_lookup(sq, piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]);
+	white += _mm_popcnt_u64(attacks & (piece_boards[ROOK] | piece_boards[QUEEN]) & piece_boards[OCC(WHITE)]);
+	black += _mm_popcnt_u64(attacks & (piece_boards[ROOK] | piece_boards[QUEEN]) & piece_boards[OCC(BLACK)]);
 
-	idx = bishop_magics[sq].offset + _pext_u64(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)], bishop_magics[sq].mask);
-	white += _mm_popcnt_u64(bishop_movetable[idx] & (piece_boards[BISHOP] | piece_boards[QUEEN]) & piece_boards[OCC(WHITE)]);
-	black += _mm_popcnt_u64(bishop_movetable[idx] & (piece_boards[BISHOP] | piece_boards[QUEEN]) & piece_boards[OCC(BLACK)]);
+	attacks = bishop_lookup(sq, piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]);
+	white += _mm_popcnt_u64(attacks & (piece_boards[BISHOP] | piece_boards[QUEEN]) & piece_boards[OCC(WHITE)]);
+	black += _mm_popcnt_u64(attacks & (piece_boards[BISHOP] | piece_boards[QUEEN]) & piece_boards[OCC(BLACK)]);
 
 	white += _mm_popcnt_u64(knight_movetable[sq] & piece_boards[KNIGHT] & piece_boards[OCC(WHITE)]);
 	black += _mm_popcnt_u64(knight_movetable[sq] & piece_boards[KNIGHT] & piece_boards[OCC(BLACK)]);
@@ -431,13 +462,87 @@ std::pair<int, int> Board::control(int sq) const {
 	return {white, black};
 }
 
+/**
+ * Set-wise slider attacks, for all the rooks and bishops (queens being both) of a side at once.
+ *
+ * Each direction is a Kogge-Stone fill: the sliders flood through the empty squares 1, 2 and
+ * then 4 squares at a time, and a last step onto the first blocker gives the attacks. `wrap`
+ * stops the moves that leave the board through the A or H file from reappearing on the other side.
+ */
+template <int D> Bitboard fill_attacks(Bitboard gen, Bitboard empty) {
+	constexpr Bitboard wrap = (D == 1 || D == 9 || D == -7) ? ~FileABits : (D == -1 || D == 7 || D == -9) ? ~FileHBits : ~0ULL;
+	empty &= wrap;
+	gen |= empty & shift<D>(gen);
+	empty &= shift<D>(empty);
+	gen |= empty & shift<2 * D>(gen);
+	empty &= shift<2 * D>(empty);
+	gen |= empty & shift<4 * D>(gen);
+	return shift<D>(gen) & wrap;
+}
+
+static Bitboard slider_fill_scalar(Bitboard rooks, Bitboard bishops, Bitboard empty) {
+	return fill_attacks<8>(rooks, empty) | fill_attacks<-8>(rooks, empty) | fill_attacks<1>(rooks, empty) | fill_attacks<-1>(rooks, empty) |
+		   fill_attacks<9>(bishops, empty) | fill_attacks<-9>(bishops, empty) | fill_attacks<7>(bishops, empty) | fill_attacks<-7>(bishops, empty);
+}
+
+// The same fills with the four directions in the lanes of one register: N, E, NE and NW shift
+// left, and S, W, SW and SE by the same amounts right
+__attribute__((target("avx2"))) static Bitboard slider_fill_avx2(Bitboard rooks, Bitboard bishops, Bitboard empty) {
+	const __m256i shifts = _mm256_setr_epi64x(8, 1, 9, 7);
+	const __m256i up_wrap = _mm256_setr_epi64x(~0ULL, ~FileABits, ~FileABits, ~FileHBits);
+	const __m256i down_wrap = _mm256_setr_epi64x(~0ULL, ~FileHBits, ~FileHBits, ~FileABits);
+	const __m256i sliders = _mm256_setr_epi64x(rooks, rooks, bishops, bishops);
+
+	__m256i up = sliders, down = sliders, s = shifts;
+	__m256i up_empty = _mm256_and_si256(_mm256_set1_epi64x(empty), up_wrap);
+	__m256i down_empty = _mm256_and_si256(_mm256_set1_epi64x(empty), down_wrap);
+	for (int i = 0; i < 3; i++) {
+		up = _mm256_or_si256(up, _mm256_and_si256(up_empty, _mm256_sllv_epi64(up, s)));
+		down = _mm256_or_si256(down, _mm256_and_si256(down_empty, _mm256_srlv_epi64(down, s)));
+		up_empty = _mm256_and_si256(up_empty, _mm256_sllv_epi64(up_empty, s));
+		down_empty = _mm256_and_si256(down_empty, _mm256_srlv_epi64(down_empty, s));
+		s = _mm256_add_epi64(s, s);
+	}
+	up = _mm256_and_si256(_mm256_sllv_epi64(up, shifts), up_wrap);
+	down = _mm256_and_si256(_mm256_srlv_epi64(down, shifts), down_wrap);
+
+	__m256i attacks = _mm256_or_si256(up, down);
+	__m128i half = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+	return _mm_cvtsi128_si64(half) | _mm_extract_epi64(half, 1);
+}
+
+Bitboard Board::attacks_by(bool color) const {
+	Bitboard own = piece_boards[OCC(color)];
+	Bitboard empty = ~(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]);
+
+	Bitboard pawns = piece_boards[PAWN] & own;
+	Bitboard attacks;
+	if (color == WHITE)
+		attacks = shift<7>(pawns & ~FileABits) | shift<9>(pawns & ~FileHBits);
+	else
+		attacks = shift<-9>(pawns & ~FileABits) | shift<-7>(pawns & ~FileHBits);
+
+	Bitboard knights = piece_boards[KNIGHT] & own;
+	Bitboard hor1 = ((knights & ~FileHBits) << 1) | ((knights & ~FileABits) >> 1);
+	Bitboard hor2 = ((knights & ~FileHBits & ~FileGBits) << 2) | ((knights & ~FileABits & ~FileBBits) >> 2);
+	attacks |= (hor1 << 16) | (hor1 >> 16) | (hor2 << 8) | (hor2 >> 8);
+
+	Bitboard king = piece_boards[KING] & own;
+	Bitboard row = king | ((king & ~FileHBits) << 1) | ((king & ~FileABits) >> 1);
+	attacks |= (row | (row << 8) | (row >> 8)) ^ king;
+
+	Bitboard rooks = (piece_boards[ROOK] | piece_boards[QUEEN]) & own;
+	Bitboard bishops = (piece_boards[BISHOP] | piece_boards[QUEEN]) & own;
+	attacks |= use_avx2 ? slider_fill_avx2(rooks, bishops, empty) : slider_fill_scalar(rooks, bishops, empty);
+	return attacks;
+}
+
 Value Board::see(Square sq) {
 	Value val = 0;
 
 	Bitboard tmp;
 	PieceType atk = NO_PIECETYPE; // Get the least valuable attacker
 	Square atksq = SQ_NONE; // Get the square of the attacker
-	uint32_t idx;
 
 	if (side == WHITE)
 		tmp = ((square_bits(Square(sq - 9)) & 0x7f7f7f7f7f7f7f7f) | (square_bits(Square(sq - 7)) & 0xfefefefefefefefe)) & piece_boards[PAWN] & piece_boards[OCC(WHITE)];
@@ -456,26 +561,22 @@ Value Board::see(Square sq) {
 		goto found;
 	}
 
-	idx = bishop_magics[sq].offset + _pext_u64(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)], bishop_magics[sq].mask);
-	tmp = bishop_movetable[idx] & piece_boards[BISHOP] & piece_boards[OCC(side)];
+	tmp = bishop_lookup(sq, piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]) & piece_boards[BISHOP] & piece_boards[OCC(side)];
 	if (tmp) {
 		atk = BISHOP;
 		atksq = Square(__tzcnt_u64(tmp));
 		goto found;
 	}
 
-	idx = rook_magics[sq].offset + _pext_u64(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)], rook_magics[sq].mask);
-	tmp = rook_movetable[idx] & piece_boards[ROOK] & piece_boards[OCC(side)];
+	tmp = rook_lookup(sq, piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]) & piece_boards[ROOK] & piece_boards[OCC(side)];
 	if (tmp) {
 		atk = ROOK;
 		atksq = Square(__tzcnt_u64(tmp));
 		goto found;
 	}
 
-	idx = bishop_magics[sq].offset + _pext_u64(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)], bishop_magics[sq].mask);
-	tmp = bishop_movetable[idx] & piece_boards[QUEEN] & piece_boards[OCC(side)];
-	idx = rook_magics[sq].offset + _pext_u64(piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)], rook_magics[sq].mask);
-	tmp |= rook_movetable[idx] & piece_boards[QUEEN] & piece_boards[OCC(side)];
+	tmp = bishop_lookup(sq, piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]) & piece_boards[QUEEN] & piece_boards[OCC(side)];
+	tmp |= rook_lookup(sq, piece_boards[OCC(WHITE)] | piece_boards[OCC(BLACK)]) & piece_boards[QUEEN] & piece_boards[OCC(side)];
 	if (tmp) {
 		atk = QUEEN;
 		atksq = Square(__tzcnt_u64(tmp));
@@ -501,21 +602,25 @@ Value Board::see_capture(Move move) {
 }
 
 Bitboard rook_attacks(Square sq, Bitboard occ) {
-	uint32_t idx = rook_magics[sq].offset + _pext_u64(occ, rook_magics[sq].mask);
-	return rook_movetable[idx];
+	return rook_lookup(sq, occ);
 }
 
 Bitboard bishop_attacks(Square sq, Bitboard occ) {
-	uint32_t idx = bishop_magics[sq].offset + _pext_u64(occ, bishop_magics[sq].mask);
-	return bishop_movetable[idx];
+	return bishop_lookup(sq, occ);
 }
 
 Bitboard queen_attacks(Square sq, Bitboard occ) {
-	uint32_t idx = rook_magics[sq].offset + _pext_u64(occ, rook_magics[sq].mask);
-	Bitboard rook = rook_movetable[idx];
-	idx = bishop_magics[sq].offset + _pext_u64(occ, bishop_magics[sq].mask);
-	Bitboard bishop = bishop_movetable[idx];
-	return rook | bishop;
+	return rook_lookup(sq, occ) | bishop_lookup(sq, occ);
+}
+
+const char *slider_layout() {
+	if (!use_pext)
+		return "magic";
+#ifdef COMPRESSED_SLIDERS
+	return "compressed PEXT/PDEP";
+#else
+	return "PEXT";
+#endif
 }
 
 Bitboard knight_attacks(Square sq) {
@@ -532,3 +637,14 @@ Bitboard pawn_attacks(Square sq, bool color) {
 	else
 		return ((square_bits(Square(sq - 7)) & 0x7f7f7f7f7f7f7f7f) | (square_bits(Square(sq - 9)) & 0xfefefefefefefefe));
 }
+
+template void pawn_moves<WHITE>(const Board &, pzstd::vector<Move> &);
+template void pawn_moves<BLACK>(const Board &, pzstd::vector<Move> &);
+template void knight_moves<WHITE>(const Board &, pzstd::vector<Move> &);
+template void knight_moves<BLACK>(const Board &, pzstd::vector<Move> &);
+template void bishop_moves<WHITE>(const Board &, pzstd::vector<Move> &);
+template void bishop_moves<BLACK>(const Board &, pzstd::vector<Move> &);
+template void rook_moves<WHITE>(const Board &, pzstd::vector<Move> &);
+template void rook_moves<BLACK>(const Board &, pzstd::vector<Move> &);
+template void king_moves<WHITE>(const Board &, pzstd::vector<Move> &);
+template void king_moves<BLACK>(const Board &, pzstd::vector<Move> &);
@@ -3,13 +3,38 @@
 #include "bitboard.hpp"
 #include "includes.hpp"
 
-void white_pawn_moves(const Board &board, pzstd::vector<Move> &moves);
-void black_pawn_moves(const Board &board, pzstd::vector<Move> &moves);
-void pawn_moves(const Board &board, pzstd::vector<Move> &moves);
-void knight_moves(const Board &board, pzstd::vector<Move> &moves);
-void bishop_moves(const Board &board, pzstd::vector<Move> &moves);
-void rook_moves(const Board &board, pzstd::vector<Move> &moves);
-void king_moves(const Board &board, pzstd::vector<Move> &moves);
+/**
+ * Knight and king attacks from every square. These and the slider tables in movegen.cpp are
+ * generated by the compiler, so they are loaded as read-only data instead of being filled in
+ * at every process start.
+ */
+struct LeaperTable {
+	Bitboard table[64];
+
+	constexpr LeaperTable(bool king) : table() {
+		for (int sq = 0; sq < 64; sq++) {
+			Bitboard piece = 1ULL << sq;
+			Bitboard hor1 = ((piece & ~FileHBits) << 1) | ((piece & ~FileABits) >> 1);
+			Bitboard hor2 = ((piece & ~FileHBits & ~FileGBits) << 2) | ((piece & ~FileABits & ~FileBBits) >> 2);
+			if (king)
+				table[sq] = ((hor1 | piece) | ((hor1 | piece) << 8) | ((hor1 | piece) >> 8)) ^ piece;
+			else
+				table[sq] = (hor1 << 16) | (hor1 >> 16) | (hor2 << 8) | (hor2 >> 8);
+		}
+	}
+
+	constexpr Bitboard operator[](int sq) const { return table[sq]; }
+};
+
+inline constexpr LeaperTable knight_movetable(false);
+inline constexpr LeaperTable king_movetable(true);
+
+// Move generators for the pieces of side `Side`, which has to be the side to move
+template <bool Side> void pawn_moves(const Board &board, pzstd::vector<Move> &moves);
+template <bool Side> void knight_moves(const Board &board, pzstd::vector<Move> &moves);
+template <bool Side> void bishop_moves(const Board &board, pzstd::vector<Move> &moves);
+template <bool Side> void rook_moves(const Board &board, pzstd::vector<Move> &moves);
+template <bool Side> void king_moves(const Board &board, pzstd::vector<Move> &moves);
 
 Bitboard rook_attacks(Square sq, Bitboard occ);
 Bitboard bishop_attacks(Square sq, Bitboard occ);
@@ -17,3 +42,6 @@ Bitboard queen_attacks(Square sq, Bitboard occ);
 Bitboard knight_attacks(Square sq);
 Bitboard king_attacks(Square sq);
 Bitboard pawn_attacks(Square sq, bool color);
+
+// The slider table layout in use (see movegen.cpp)
+const char *slider_layout();
@@ -9,7 +9,9 @@
 #ifndef INCBIN_HDR
 #define INCBIN_HDR
 #include <limits.h>
-#if   defined(__AVX512BW__) || \
+#if   defined(INCBIN_ALIGNMENT_INDEX)
+/* Chosen by the includer */
+#elif defined(__AVX512BW__) || \
       defined(__AVX512CD__) || \
       defined(__AVX512DQ__) || \
       defined(__AVX512ER__) || \
@@ -1,58 +1,334 @@
 #include "network.hpp"
+#include "../cpu.hpp"
+#include "../mappedfile.hpp"
+
+// The embedded network is used in place, so it needs the same alignment as a loaded one
+#define INCBIN_ALIGNMENT_INDEX 6
 #include "incbin.h"
 
 extern "C" {
 	INCBIN(network_weights, NNUE_PATH);
 }
 
-void Network::load() {
-	char *ptr = (char *)gnetwork_weightsData;
-	memcpy(accumulator_weights, ptr, sizeof(accumulator_weights));
-	ptr += sizeof(accumulator_weights);
-	memcpy(accumulator_biases, ptr, sizeof(accumulator_biases));
-	ptr += sizeof(accumulator_biases);
-	memcpy(output_weights, ptr, sizeof(output_weights));
-	ptr += sizeof(output_weights);
-	memcpy(&output_bias, ptr, sizeof(output_bias));
+ActiveNetwork nnue_network = {ARCH_DEFAULT, gnetwork_weightsData, DefaultArch::HL_SIZE};
+
+static std::string current_name = NNUE_PATH;
+
+// The file backing nnue_network, if it isn't the embedded network
+static MappedFile mapped_file;
+
+// What a network file header has to say for each architecture built in
+struct ArchInfo {
+	NetworkArchId id;
+	uint32_t input_size, hl_size, nbuckets;
+	int32_t qa, qb, scale;
+	size_t size;
+};
+
+template <typename Arch>
+static constexpr ArchInfo arch_info(NetworkArchId id) {
+	return {id, Arch::INPUT_SIZE, Arch::HL_SIZE, Arch::NBUCKETS, Arch::QA, Arch::QB, Arch::SCALE, sizeof(Network<Arch>)};
+}
+
+static constexpr ArchInfo archs[] = {arch_info<SmallArch>(ARCH_SMALL), arch_info<DefaultArch>(ARCH_DEFAULT), arch_info<LargeArch>(ARCH_LARGE),
+									 arch_info<BucketedArch>(ARCH_BUCKETED)};
+
+static uint64_t fnv1a(const char *data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Find the weights in a network file and their architecture, or return false and fill `error` if it doesn't fit this engine
+static bool parse_network(const char *data, size_t size, ActiveNetwork &net, std::string &error) {
+	const ArchInfo *arch = nullptr;
+	const NetworkHeader *header = (const NetworkHeader *)data;
+	if (size >= sizeof(NetworkHeader) && memcmp(header->magic, NNUE_MAGIC, 4) == 0) {
+		if (header->version != NNUE_VERSION) {
+			error = "unsupported version " + std::to_string(header->version);
+			return false;
+		}
+		for (const ArchInfo &info : archs) {
+			if (header->input_size == info.input_size && header->hl_size == info.hl_size && header->nbuckets == info.nbuckets && header->qa == info.qa &&
+				header->qb == info.qb && header->scale == info.scale)
+				arch = &info;
+		}
+		if (!arch) {
+			error = "architecture (" + std::to_string(header->input_size) + "->" + std::to_string(header->hl_size) + ")x2->" + std::to_string(header->nbuckets) +
+					" is not built in";
+			return false;
+		}
+		if (header->size != arch->size || size != sizeof(NetworkHeader) + arch->size) {
+			error = "truncated or oversized file";
+			return false;
+		}
+		if (fnv1a(data + sizeof(NetworkHeader), arch->size) != header->checksum) {
+			error = "checksum mismatch";
+			return false;
+		}
+		data += sizeof(NetworkHeader);
+	} else {
+		// Headerless, which only works if the size gives the architecture away
+		for (const ArchInfo &info : archs) {
+			if (size == info.size)
+				arch = &info;
+		}
+		if (!arch) {
+			error = "not a network file";
+			return false;
+		}
+	}
+	net = {arch->id, data, (int)arch->hl_size};
+
+	// The SIMD output kernels multiply clipped activations by the weights in 16 bits
+	bool in_range = with_network(net, [](const auto &weights) {
+		for (auto &bucket : weights.output_weights) {
+			for (int16_t w : bucket) {
+				if (w < -128 || w > 128)
+					return false;
+			}
+		}
+		return true;
+	});
+	if (!in_range) {
+		error = "output weights out of range";
+		return false;
+	}
+	return true;
+}
+
+void load_embedded_network() {
+	nnue_network = {ARCH_DEFAULT, gnetwork_weightsData, DefaultArch::HL_SIZE};
+	current_name = NNUE_PATH;
+	mapped_file = MappedFile();
+}
+
+bool load_network_file(const std::string &path, std::string &error) {
+	MappedFile file;
+	if (!file.open(path, error))
+		return false;
+	ActiveNetwork net;
+	if (!parse_network(file.data(), file.size(), net, error))
+		return false;
+	nnue_network = net;
+	current_name = path;
+	mapped_file = std::move(file);
+	return true;
 }
 
-int calculate_index(Square sq, PieceType pt, bool side, bool perspective) {
-	if (perspective) {
-		side = !side;
-		sq = (Square)(sq ^ 56);
+const std::string &network_name() {
+	return current_name;
+}
+
+bool pack_network_file(const std::string &in, const std::string &out, std::string &error) {
+	std::ifstream input(in, std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	const ArchInfo *arch = nullptr;
+	for (const ArchInfo &info : archs) {
+		if (data.size() == info.size)
+			arch = &info;
+	}
+	if (!input || !arch) {
+		error = in + " is not a raw network of any built in architecture";
+		return false;
 	}
-	return side * 64 * 6 + pt * 64 + sq;
+	NetworkHeader header = {};
+	memcpy(header.magic, NNUE_MAGIC, 4);
+	header.version = NNUE_VERSION;
+	header.input_size = arch->input_size;
+	header.hl_size = arch->hl_size;
+	header.nbuckets = arch->nbuckets;
+	header.qa = arch->qa;
+	header.qb = arch->qb;
+	header.scale = arch->scale;
+	header.size = arch->size;
+	header.checksum = fnv1a(data.data(), data.size());
+	std::ofstream output(out, std::ios::binary);
+	output.write((const char *)&header, sizeof(header));
+	output.write(data.data(), data.size());
+	if (!output) {
+		error = "cannot write " + out;
+		return false;
+	}
+	return true;
 }
 
-void accumulator_add(const Network &net, Accumulator &acc, uint16_t index) {
+template <typename Arch>
+void accumulator_add(const Network<Arch> &net, Accumulator<Arch> &acc, uint16_t index) {
 	// Note: do not need to manually vectorize this, compiler will do it for us
-	for (int i = 0; i < HL_SIZE; i++) {
+	for (int i = 0; i < Arch::HL_SIZE; i++) {
 		acc.val[i] += net.accumulator_weights[index][i];
 	}
 }
 
-void accumulator_sub(const Network &net, Accumulator &acc, uint16_t index) {
+template <typename Arch>
+void accumulator_sub(const Network<Arch> &net, Accumulator<Arch> &acc, uint16_t index) {
 	// Note: do not need to manually vectorize this, compiler will do it for us
-	for (int i = 0; i < HL_SIZE; i++) {
+	for (int i = 0; i < Arch::HL_SIZE; i++) {
 		acc.val[i] -= net.accumulator_weights[index][i];
 	}
 }
 
-int32_t nnue_eval(const Network &net, const Accumulator &stm, const Accumulator &ntm, uint8_t nbucket) {
-	/// TODO: vectorize
-	int32_t score = 0;
-	for (int i = 0; i < HL_SIZE; i++) {
-		int input = std::clamp((int)stm.val[i], 0, QA);
-		int weight = input * net.output_weights[nbucket][i];
-		score += input * weight;
+// The fused kernels keep each chunk of the accumulator in registers while all rows are applied,
+// so the accumulator is read and written once instead of once per feature
+template <typename Arch>
+void accumulator_add_sub(const Network<Arch> &net, const Accumulator<Arch> &src, Accumulator<Arch> &dst, uint16_t add, uint16_t sub) {
+	const int16_t *a = net.accumulator_weights[add], *s = net.accumulator_weights[sub];
+	for (int i = 0; i < Arch::HL_SIZE; i++) {
+		dst.val[i] = src.val[i] + a[i] - s[i];
+	}
+}
+
+template <typename Arch>
+void accumulator_add_sub2(const Network<Arch> &net, const Accumulator<Arch> &src, Accumulator<Arch> &dst, uint16_t add, uint16_t sub1, uint16_t sub2) {
+	const int16_t *a = net.accumulator_weights[add], *s1 = net.accumulator_weights[sub1], *s2 = net.accumulator_weights[sub2];
+	for (int i = 0; i < Arch::HL_SIZE; i++) {
+		dst.val[i] = src.val[i] + a[i] - s1[i] - s2[i];
+	}
+}
+
+template <typename Arch>
+void accumulator_add2_sub2(const Network<Arch> &net, const Accumulator<Arch> &src, Accumulator<Arch> &dst, uint16_t add1, uint16_t add2, uint16_t sub1, uint16_t sub2) {
+	const int16_t *a1 = net.accumulator_weights[add1], *a2 = net.accumulator_weights[add2];
+	const int16_t *s1 = net.accumulator_weights[sub1], *s2 = net.accumulator_weights[sub2];
+	for (int i = 0; i < Arch::HL_SIZE; i++) {
+		dst.val[i] = src.val[i] + a1[i] + a2[i] - s1[i] - s2[i];
+	}
+}
+
+/**
+ * Sum of SCReLU(acc[i]) * weights[i] over one perspective, where SCReLU(x) = clamp(x, 0, QA)^2.
+ * 
+ * The SIMD kernels compute v * (v * w) instead of v^2 * w: v * w is done in 16 bits, which
+ * can't overflow as long as |w| <= 128 (so that QA * w fits in an int16_t), and madd then
+ * multiplies by v again and sums pairs into 32 bits. With VNNI the madd and the add fuse.
+ * 
+ * Every kernel is compiled for its own instruction set, and the best one the CPU supports is
+ * picked at startup, so the same binary runs on any x86-64 machine.
+ */
+// Sum of the 16 lanes. GCC's _mm512_reduce_add_epi32 (and _mm512_castsi512_si256) extract into an
+// undefined vector, which -Wall reports as uninitialized, so the halves are extracted with a full mask
+__attribute__((target("avx512f"))) static inline int32_t hsum_epi32_avx512(__m512i sum) {
+	__m256i sum256 = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xf, sum, 0), _mm512_maskz_extracti64x4_epi64(0xf, sum, 1));
+	__m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum128);
+}
+
+template <typename Arch>
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) static int32_t screlu_dot_vnni(const int16_t *acc, const int16_t *weights) {
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i qa = _mm512_set1_epi16(Arch::QA);
+	__m512i sum = _mm512_setzero_si512();
+	for (int i = 0; i < Arch::HL_SIZE; i += 32) {
+		__m512i v = _mm512_min_epi16(_mm512_max_epi16(_mm512_load_si512(acc + i), zero), qa);
+		__m512i vw = _mm512_mullo_epi16(v, _mm512_load_si512(weights + i));
+		sum = _mm512_dpwssd_epi32(sum, v, vw);
+	}
+	return hsum_epi32_avx512(sum);
+}
+
+template <typename Arch>
+__attribute__((target("avx512f,avx512bw"))) static int32_t screlu_dot_avx512(const int16_t *acc, const int16_t *weights) {
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i qa = _mm512_set1_epi16(Arch::QA);
+	__m512i sum = _mm512_setzero_si512();
+	for (int i = 0; i < Arch::HL_SIZE; i += 32) {
+		__m512i v = _mm512_min_epi16(_mm512_max_epi16(_mm512_load_si512(acc + i), zero), qa);
+		__m512i vw = _mm512_mullo_epi16(v, _mm512_load_si512(weights + i));
+		sum = _mm512_add_epi32(sum, _mm512_madd_epi16(v, vw));
+	}
+	return hsum_epi32_avx512(sum);
+}
+
+template <typename Arch>
+__attribute__((target("avx2"))) static int32_t screlu_dot_avx2(const int16_t *acc, const int16_t *weights) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i qa = _mm256_set1_epi16(Arch::QA);
+	__m256i sum = _mm256_setzero_si256();
+	for (int i = 0; i < Arch::HL_SIZE; i += 16) {
+		__m256i v = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i *)(acc + i)), zero), qa);
+		__m256i vw = _mm256_mullo_epi16(v, _mm256_load_si256((const __m256i *)(weights + i)));
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(v, vw));
+	}
+	__m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum128);
+}
+
+template <typename Arch>
+static int32_t screlu_dot_scalar(const int16_t *acc, const int16_t *weights) {
+	int32_t sum = 0;
+	for (int i = 0; i < Arch::HL_SIZE; i++) {
+		int input = std::clamp((int)acc[i], 0, Arch::QA);
+		sum += input * input * weights[i];
+	}
+	return sum;
+}
+
+enum ScreluLevel { SCRELU_SCALAR, SCRELU_AVX2, SCRELU_AVX512, SCRELU_VNNI };
+
+static ScreluLevel select_screlu_level() {
+	const CpuFeatures &cpu = cpu_features();
+	if (cpu.vnni)
+		return SCRELU_VNNI;
+	if (cpu.avx512)
+		return SCRELU_AVX512;
+	if (cpu.avx2)
+		return SCRELU_AVX2;
+	return SCRELU_SCALAR;
+}
+
+static const ScreluLevel screlu_level = select_screlu_level();
+
+using ScreluDot = int32_t (*)(const int16_t *, const int16_t *);
 
-		input = std::clamp((int)ntm.val[i], 0, QA);
-		weight = input * net.output_weights[nbucket][HL_SIZE + i];
-		score += input * weight;
+template <typename Arch>
+static ScreluDot select_screlu_kernel() {
+	switch (screlu_level) {
+	case SCRELU_VNNI:
+		return screlu_dot_vnni<Arch>;
+	case SCRELU_AVX512:
+		return screlu_dot_avx512<Arch>;
+	case SCRELU_AVX2:
+		return screlu_dot_avx2<Arch>;
+	default:
+		return screlu_dot_scalar<Arch>;
 	}
-	score /= QA;
+}
+
+template <typename Arch>
+static const ScreluDot screlu_dot = select_screlu_kernel<Arch>();
+
+const char *nnue_kernel() {
+	static const char *names[] = {"scalar", "avx2", "avx512", "avx512-vnni"};
+	return names[screlu_level];
+}
+
+template <typename Arch>
+int32_t nnue_eval(const Network<Arch> &net, const Accumulator<Arch> &stm, const Accumulator<Arch> &ntm, uint8_t nbucket) {
+	int32_t score = screlu_dot<Arch>(stm.val, net.output_weights[nbucket]) + screlu_dot<Arch>(ntm.val, net.output_weights[nbucket] + Arch::HL_SIZE);
+	score /= Arch::QA;
 	score += net.output_bias[nbucket];
-	score *= SCALE;
-	score /= QA * QB;
+	score *= Arch::SCALE;
+	score /= Arch::QA * Arch::QB;
 	return score;
 }
+
+#define INSTANTIATE_NETWORK(Arch)                                                                                                                              \
+	template void accumulator_add<Arch>(const Network<Arch> &, Accumulator<Arch> &, uint16_t);                                                                  \
+	template void accumulator_sub<Arch>(const Network<Arch> &, Accumulator<Arch> &, uint16_t);                                                                  \
+	template void accumulator_add_sub<Arch>(const Network<Arch> &, const Accumulator<Arch> &, Accumulator<Arch> &, uint16_t, uint16_t);                         \
+	template void accumulator_add_sub2<Arch>(const Network<Arch> &, const Accumulator<Arch> &, Accumulator<Arch> &, uint16_t, uint16_t, uint16_t);              \
+	template void accumulator_add2_sub2<Arch>(const Network<Arch> &, const Accumulator<Arch> &, Accumulator<Arch> &, uint16_t, uint16_t, uint16_t, uint16_t);  \
+	template int32_t nnue_eval<Arch>(const Network<Arch> &, const Accumulator<Arch> &, const Accumulator<Arch> &, uint8_t)
+
+INSTANTIATE_NETWORK(SmallArch);
+INSTANTIATE_NETWORK(DefaultArch);
+INSTANTIATE_NETWORK(LargeArch);
+INSTANTIATE_NETWORK(BucketedArch);
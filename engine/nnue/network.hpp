@@ -2,30 +2,195 @@
 
 #include "../includes.hpp"
 
-#define INPUT_SIZE 768
-#define HL_SIZE 256
-#define NBUCKETS 8
-#define SCALE 400
-#define QA 255
-#define QB 64
+// Everything the SIMD kernels load is aligned to a full AVX-512 register
+#define NNUE_ALIGN 64
 
+// Buckets for a king on each square (from its own side), for nets whose inputs are split by king
+// position. Mirrored nets flip the board so that the king is always on files a-d, and this layout
+// is symmetric so that it reads the same either way.
+constexpr uint8_t KING_BUCKET_LAYOUT_4[64] = {
+	0, 0, 1, 1, 1, 1, 0, 0, // 1
+	2, 2, 2, 2, 2, 2, 2, 2, // 2
+	3, 3, 3, 3, 3, 3, 3, 3, // 3
+	3, 3, 3, 3, 3, 3, 3, 3, // 4
+	3, 3, 3, 3, 3, 3, 3, 3, // 5
+	3, 3, 3, 3, 3, 3, 3, 3, // 6
+	3, 3, 3, 3, 3, 3, 3, 3, // 7
+	3, 3, 3, 3, 3, 3, 3, 3, // 8
+};
+
+/**
+ * Shape and quantisation of a (INPUT_SIZE->HL_SIZE)x2->1 network with NBUCKETS output buckets.
+ *
+ * The inputs are the usual 768 piece-square features, repeated once per king bucket. With more
+ * than one bucket, each perspective also mirrors the board horizontally when its king is on
+ * files e-h.
+ *
+ * Network, Accumulator and the kernels are templates over this, so that nets of several sizes
+ * can be built into the same binary. The file header says which one a network file uses.
+ */
+template <int KingBuckets, int HiddenSize, int OutputBuckets, int Qa, int Qb, int Scale>
+struct NetworkArch {
+	static constexpr int KING_BUCKETS = KingBuckets;
+	static constexpr bool MIRRORED = KingBuckets > 1;
+	static constexpr int INPUT_SIZE = 768 * KingBuckets;
+	static constexpr int HL_SIZE = HiddenSize;
+	static constexpr int NBUCKETS = OutputBuckets;
+	static constexpr int QA = Qa;
+	static constexpr int QB = Qb;
+	static constexpr int SCALE = Scale;
+
+	static_assert(KING_BUCKETS == 1 || KING_BUCKETS == 4, "no king bucket layout for this size");
+	static_assert(HL_SIZE % 32 == 0, "the SIMD kernels work on whole AVX-512 registers");
+	static_assert(QA * 128 <= INT16_MAX, "the SIMD kernels multiply activations by weights in 16 bits");
+
+	// Output buckets split the positions evenly by piece count, from 2 to 32 pieces
+	static constexpr int output_bucket(int npieces) { return (npieces - 2) * NBUCKETS / 32; }
+
+	/**
+	 * Which part of the inputs a perspective uses with its king on `ksq`, as bucket * 2 + mirrored.
+	 *
+	 * Positions with the same key share the indices of every feature, so the accumulators can be
+	 * updated incrementally between them. Any other king move needs a refresh.
+	 */
+	static constexpr int king_key(Square ksq, bool perspective) {
+		if constexpr (KING_BUCKETS == 1) {
+			return 0;
+		} else {
+			if (perspective)
+				ksq = (Square)(ksq ^ 56);
+			return KING_BUCKET_LAYOUT_4[ksq] * 2 + (MIRRORED && (ksq & 7) >= 4);
+		}
+	}
+
+	// Input index of a piece from one perspective, given the king square of that perspective
+	static constexpr int feature_index(Square sq, PieceType pt, bool side, bool perspective, Square ksq) {
+		if (perspective) {
+			side = !side;
+			sq = (Square)(sq ^ 56);
+		}
+		int key = king_key(ksq, perspective);
+		if (key & 1)
+			sq = (Square)(sq ^ 7);
+		return (key >> 1) * 768 + side * 64 * 6 + pt * 64 + sq;
+	}
+};
+
+// The architectures this binary can run, a small fast net for bullet and datagen and a larger one for long games
+using SmallArch = NetworkArch<1, 128, 8, 255, 64, 400>;
+using DefaultArch = NetworkArch<1, 256, 8, 255, 64, 400>;
+using LargeArch = NetworkArch<1, 512, 8, 255, 64, 400>;
+using BucketedArch = NetworkArch<4, 256, 8, 255, 64, 400>;
+
+enum NetworkArchId { ARCH_SMALL, ARCH_DEFAULT, ARCH_LARGE, ARCH_BUCKETED };
+
+// Largest hidden layer and number of king buckets of the architectures above, which size the accumulator storage of the board
+#define MAX_HL_SIZE 512
+#define MAX_KING_BUCKETS 4
+
+template <typename Arch>
 struct Accumulator {
-	int16_t val[HL_SIZE] = {};
+	alignas(NNUE_ALIGN) int16_t val[Arch::HL_SIZE] = {};
 };
 
+template <typename A>
 struct Network {
-	int16_t accumulator_weights[INPUT_SIZE][HL_SIZE];
-	int16_t accumulator_biases[HL_SIZE];
-	int16_t output_weights[NBUCKETS][2 * HL_SIZE];
-	int16_t output_bias[NBUCKETS];
+	using Arch = A;
+
+	alignas(NNUE_ALIGN) int16_t accumulator_weights[Arch::INPUT_SIZE][Arch::HL_SIZE];
+	alignas(NNUE_ALIGN) int16_t accumulator_biases[Arch::HL_SIZE];
+	alignas(NNUE_ALIGN) int16_t output_weights[Arch::NBUCKETS][2 * Arch::HL_SIZE];
+	alignas(NNUE_ALIGN) int16_t output_bias[Arch::NBUCKETS];
+};
+
+// Network files start with this header, followed directly by the Network itself
+#define NNUE_MAGIC "PZNN"
+#define NNUE_VERSION 2
 
-	void load();
+struct NetworkHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t input_size, hl_size, nbuckets; // Which NetworkArch the weights are for
+	int32_t qa, qb, scale;
+	uint64_t size; // Bytes of weights after the header
+	uint64_t checksum; // FNV-1a hash of those bytes
+	char padding[16]; // Keeps the weights aligned to NNUE_ALIGN
 };
 
-int calculate_index(Square sq, PieceType pt, bool side, bool perspective);
+static_assert(sizeof(NetworkHeader) == NNUE_ALIGN, "the weights must stay aligned after the header");
+
+/**
+ * The network used for evaluation.
+ *
+ * The weights are never copied: they point straight into the network embedded in the binary,
+ * or into a memory-mapped EvalFile. Accumulators built with a previous network must be
+ * refreshed after switching.
+ */
+struct ActiveNetwork {
+	NetworkArchId arch;
+	const void *weights; // A Network<Arch> of that architecture
+	int hl_size;
+};
+
+extern ActiveNetwork nnue_network;
+
+// Call `f` with the active network as a Network<Arch> of its architecture, so that it runs the kernels of that size
+template <typename F>
+inline auto with_network(const ActiveNetwork &net, F &&f) {
+	switch (net.arch) {
+	case ARCH_SMALL:
+		return f(*(const Network<SmallArch> *)net.weights);
+	case ARCH_LARGE:
+		return f(*(const Network<LargeArch> *)net.weights);
+	case ARCH_BUCKETED:
+		return f(*(const Network<BucketedArch> *)net.weights);
+	default:
+		return f(*(const Network<DefaultArch> *)net.weights);
+	}
+}
+
+template <typename F>
+inline auto with_network(F &&f) {
+	return with_network(nnue_network, f);
+}
+
+// Point nnue_network at the network embedded in the binary
+void load_embedded_network();
+
+// Map the network file at `path` and switch to it, returns false and fills `error` if it can't be used.
+// Headerless files holding exactly one Network<DefaultArch> (as embedded) are accepted for compatibility
+bool load_network_file(const std::string &path, std::string &error);
+
+// Name of the network in use, either NNUE_PATH or the last loaded EvalFile
+const std::string &network_name();
+
+// Write the raw network at `in` to `out`, with a header for the architecture of that size, so that it can be loaded as an EvalFile
+bool pack_network_file(const std::string &in, const std::string &out, std::string &error);
+
+template <typename Arch>
+void accumulator_add(const Network<Arch> &net, Accumulator<Arch> &acc, uint16_t index);
+
+template <typename Arch>
+void accumulator_sub(const Network<Arch> &net, Accumulator<Arch> &acc, uint16_t index);
+
+// Fused updates that derive dst from src in a single pass, for quiet moves, captures and castling
+template <typename Arch>
+void accumulator_add_sub(const Network<Arch> &net, const Accumulator<Arch> &src, Accumulator<Arch> &dst, uint16_t add, uint16_t sub);
+
+template <typename Arch>
+void accumulator_add_sub2(const Network<Arch> &net, const Accumulator<Arch> &src, Accumulator<Arch> &dst, uint16_t add, uint16_t sub1, uint16_t sub2);
+
+template <typename Arch>
+void accumulator_add2_sub2(const Network<Arch> &net, const Accumulator<Arch> &src, Accumulator<Arch> &dst, uint16_t add1, uint16_t add2, uint16_t sub1, uint16_t sub2);
 
-void accumulator_add(const Network &net, Accumulator &acc, uint16_t index);
+// Start pulling a feature's weight row of the active network into the cache ahead of an accumulator update
+// (the hardware prefetcher picks up the rest of the row once the first line is requested)
+inline void accumulator_prefetch(uint16_t index) {
+	_mm_prefetch((const char *)nnue_network.weights + (size_t)index * nnue_network.hl_size * sizeof(int16_t), _MM_HINT_T0);
+}
 
-void accumulator_sub(const Network &net, Accumulator &acc, uint16_t index);
+// Name of the output layer kernel selected for this CPU
+const char *nnue_kernel();
 
-int32_t nnue_eval(const Network &net, const Accumulator &stm, const Accumulator &ntm, uint8_t nbucket);
\ No newline at end of file
+template <typename Arch>
+int32_t nnue_eval(const Network<Arch> &net, const Accumulator<Arch> &stm, const Accumulator<Arch> &ntm, uint8_t nbucket);
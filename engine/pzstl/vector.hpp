@@ -52,8 +52,7 @@ namespace pzstd {
 		}
 	};
 
-	// This struct is (temporarily) necessary for storing hash_hist as games may last longer than 256 ply.
-	// In theory, once hash_hist is implemented properly, it will never exceed size 50 due to the 50 move rule.
+	// A vector with room for games longer than 256 ply
 	template<typename T>
 	struct largevector {
 		T data[1024];
@@ -2,6 +2,7 @@
 
 #define MOVENUM(x) ((((#x)[1] - '1') << 12) | (((#x)[0] - 'a') << 8) | (((#x)[3] - '1') << 4) | ((#x)[2] - 'a'))
 
+TTable ttable(DEFAULT_TT_SIZE);
 uint64_t nodes = 0; // Node count
 int seldepth = 0; // Maximum searched depth, including quiescence search
 uint64_t mx_nodes = 1e18; // Maximum nodes to search
@@ -29,6 +30,53 @@ uint64_t perft(Board &board, int depth) {
 	return cnt;
 }
 
+void bench_movegen() {
+	const char *fens[] = {
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	};
+	constexpr int N = sizeof(fens) / sizeof(fens[0]);
+	constexpr int ITERS = 1000000;
+	Board boards[N] = {Board(fens[0]), Board(fens[1]), Board(fens[2]), Board(fens[3])};
+
+	uint64_t checksum = 0;
+	clock_t start = clock();
+	for (int i = 0; i < ITERS; i++) {
+		pzstd::vector<Move> moves;
+		boards[i % N].legal_moves(moves);
+		checksum += moves.size();
+	}
+	double legal_ns = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ITERS;
+
+	start = clock();
+	for (int i = 0; i < ITERS; i++) {
+		auto control = boards[i % N].control(i & 63);
+		checksum += control.first + control.second;
+	}
+	double control_ns = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ITERS;
+
+	start = clock();
+	for (int i = 0; i < ITERS; i++)
+		checksum += _mm_popcnt_u64(boards[i % N].attacks_by(i & 1));
+	double attacks_ns = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ITERS;
+
+	start = clock();
+	uint64_t perft_nodes = 0;
+	for (int i = 0; i < N; i++)
+		perft_nodes += perft(boards[i], 4);
+	double perft_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "slider tables: " << slider_layout() << std::endl;
+	std::cout << "legal_moves: " << legal_ns << " ns/call" << std::endl;
+	std::cout << "control: " << control_ns << " ns/call" << std::endl;
+	std::cout << "attacks_by: " << attacks_ns << " ns/call" << std::endl;
+	std::cout << std::setprecision(0) << "perft: " << perft_nodes << " nodes " << perft_nodes / perft_s << " nps" << std::endl;
+	std::cout << "checksum " << checksum << std::endl;
+}
+
 /**
  * Determines the amount of depth to reduce the search by, given the move's index and the remaining depth
  * 
@@ -38,7 +86,7 @@ uint64_t perft(Board &board, int depth) {
 uint16_t reduction(int i, int d) {
 	if (d <= 1 || i <= 1)
 		return 1; // Don't reduce on nodes that lead to leaves since the TT doesn't provide info
-	return 0.77 + log2(i) * log2(d) / 2.36;
+	return LMR_BASE / 100.0 + log2(i) * log2(d) / (LMR_DIVISOR / 100.0);
 }
 
 /**
@@ -48,18 +96,24 @@ uint16_t reduction(int i, int d) {
  * 
  * This is currently not used because somehow static eval sorting is outperforming it.
  */
-Value MVV_LVA[6][6];
-
-__attribute__((constructor)) void init_mvvlva() {
-	for (int i = 0; i < 6; i++) {
-		for (int j = 0; j < 6; j++) {
-			if (i == KING)
-				MVV_LVA[i][j] = QueenValue * 12 + 1; // Prioritize over all other captures
-			else
-				MVV_LVA[i][j] = PieceValue[i] * 12 - PieceValue[j];
+struct MvvLvaTable {
+	Value table[6][6];
+
+	constexpr MvvLvaTable() : table() {
+		for (int i = 0; i < 6; i++) {
+			for (int j = 0; j < 6; j++) {
+				if (i == KING)
+					table[i][j] = QueenValue * 12 + 1; // Prioritize over all other captures
+				else
+					table[i][j] = PieceValue[i] * 12 - PieceValue[j];
+			}
 		}
 	}
-}
+
+	constexpr const Value *operator[](int victim) const { return table[victim]; }
+};
+
+constexpr MvvLvaTable MVV_LVA;
 
 /**
  * Killer moves are a heuristic for move ordering that helps sort consistently good moves.
@@ -98,11 +152,10 @@ int pvlen[MAX_PLY];
  * 
  * TODO:
  * - Search for checks and check evasions
- * - Delta pruning (sort of like futility pruning, see https://www.chessprogramming.org/Delta_Pruning)
  * - Late move reduction (instead of reducing depth, we reduce the search window)
  * - Static exchange evaluation (don't search moves that lose material, see https://www.chessprogramming.org/Static_Exchange_Evaluation)
  */
-Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
+Value quiesce(Board &board, Value alpha, Value beta, int depth) {
 	nodes++;
 
 	if (early_exit) return 0;
@@ -118,7 +171,7 @@ Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
 	}
 
 	seldepth = std::max(depth, seldepth);
-	Value stand_pat = eval(board) * side;
+	Value stand_pat = eval(board) * (board.side == WHITE ? 1 : -1);
 
 	// If it's a mate, stop here since there's no point in searching further
 	if (stand_pat == VALUE_MATE || stand_pat == -VALUE_MATE)
@@ -127,9 +180,41 @@ Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
 	// If we are too good, return the score
 	if (stand_pat >= beta)
 		return stand_pat;
+
+	/**
+	 * Delta pruning (see https://www.chessprogramming.org/Delta_Pruning)
+	 * 
+	 * If even winning the opponent's most valuable piece (and promoting) can't bring us back up
+	 * to alpha, no capture will, so we can fail low right away. Likewise, single captures that
+	 * can't reach alpha are skipped without being made.
+	 * 
+	 * This is unreliable in the late endgame, where a single capture can decide the game, so we
+	 * only do it while there is enough material on the board.
+	 */
+	const bool delta_pruning = board.phase >= DELTA_MIN_PHASE;
+	if (delta_pruning) {
+		Bitboard opp = board.piece_boards[OPPOCC(board.side)];
+		int max_gain = PawnValue;
+		if (opp & board.piece_boards[QUEEN])
+			max_gain = QueenValue;
+		else if (opp & board.piece_boards[ROOK])
+			max_gain = RookValue;
+		else if (opp & (board.piece_boards[BISHOP] | board.piece_boards[KNIGHT]))
+			max_gain = BishopValue;
+		if (board.piece_boards[PAWN] & board.piece_boards[OCC(board.side)] & (board.side == WHITE ? Rank7Bits : Rank2Bits))
+			max_gain += QueenValue - PawnValue;
+		if (stand_pat + max_gain * CP_SCALE_FACTOR + DELTA_THRESHOLD < alpha) {
+			// The opponent's king is worth more than anything, so make sure it can't be captured
+			auto control = board.control(__tzcnt_u64(board.piece_boards[KING] & opp));
+			if (!(board.side == WHITE ? control.first : control.second))
+				return stand_pat + max_gain * CP_SCALE_FACTOR + DELTA_THRESHOLD;
+		}
+	}
+
 	if (stand_pat > alpha)
 		alpha = stand_pat;
 
+	Value best = stand_pat;
 	pzstd::vector<Move> moves;
 	board.legal_moves(moves);
 
@@ -137,6 +222,11 @@ Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
 	pzstd::vector<std::pair<Move, Value>> scores;
 	for (Move &move : moves) {
 		if (board.piece_boards[OPPOCC(board.side)] & square_bits(move.dst())) {
+			int optimistic = stand_pat + PieceValue[board.mailbox[move.dst()] & 7] * CP_SCALE_FACTOR + DELTA_THRESHOLD;
+			if (delta_pruning && move.type() != PROMOTION && optimistic < alpha) {
+				best = std::max<int>(best, optimistic); // This capture can't raise alpha, but it bounds our score
+				continue;
+			}
 			Value score = 0;
 			score = MVV_LVA[board.mailbox[move.dst()] & 7][board.mailbox[move.src()] & 7];
 			scores.push_back({move, score});
@@ -146,8 +236,6 @@ Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
 	}
 	std::stable_sort(scores.begin(), scores.end(), [&](const std::pair<Move, Value> &a, const std::pair<Move, Value> &b) { return a.second > b.second; });
 
-	Value best = stand_pat;
-
 	for (int i = 0; i < scores.size(); i++) {
 		Move &move = scores[i].first;
 
@@ -157,7 +245,8 @@ Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
 		// }
 
 		board.make_move(move);
-		Value score = -quiesce(board, -beta, -alpha, -side, depth + 1);
+		eval_cache.prefetch(board.zobrist);
+		Value score = -quiesce(board, -beta, -alpha, depth + 1);
 		board.unmake_move();
 
 		if (score >= VALUE_MATE_MAX_PLY)
@@ -183,7 +272,7 @@ Value quiesce(Board &board, Value alpha, Value beta, int side, int depth) {
  * are sorted based on:
  * - MVV_LVA (most valuable victim, least valuable attacker) for captures
  * - Piece value for promotions
- * - History heuristic for quiet moves
+ * - History heuristic for quiet moves, plus their NNUE static eval at higher depths
  * - Killer moves (moves that have caused a beta cutoff in the past)
  * 
  * TODO: 
@@ -193,14 +282,20 @@ pzstd::vector<std::pair<Move, Value>> order_moves(Board &board, pzstd::vector<Mo
 	pzstd::vector<std::pair<Move, Value>> scores;
 	// If we have a TTable entry *at all* for this position, we should use it
 	// Even if it falls outside of our alpha-beta window, it probably provides a decent move
-	TTable::TTEntry *tentry = board.ttable.probe(board.zobrist, VALUE_INFINITE, -VALUE_INFINITE, -1);
+	TTable::TTEntry *tentry = ttable.probe(board.zobrist, VALUE_INFINITE, -VALUE_INFINITE, -1);
 	Move entry = tentry ? tentry->best_move : NullMove;
 	entry_exists = false;
 	if (entry != NullMove) {
 		scores.push_back({entry, VALUE_INFINITE}); // Make the TT move first
 		entry_exists = true;
 	}
-	for (Move &move : moves) {
+	// Deeper in the tree, the children's static evals are worth computing to order quiet moves
+	Value child_evals[PZSTL_MAX_SIZE];
+	const bool use_evals = depth >= EVAL_ORDER_DEPTH;
+	if (use_evals)
+		eval_children(board, moves, child_evals);
+	for (int i = 0; i < moves.size(); i++) {
+		Move &move = moves[i];
 		if (move == entry) continue; // Don't add the TT move again
 		Value score = 0;
 		if (board.piece_boards[OPPOCC(board.side)] & square_bits(move.dst())) {
@@ -210,14 +305,16 @@ pzstd::vector<std::pair<Move, Value>> order_moves(Board &board, pzstd::vector<Mo
 		} else {
 			// Non-capture, non-promotion, so check history
 			score = history[board.side][move.src()][move.dst()];
+			if (use_evals)
+				score += std::clamp(child_evals[i] * side, -EVAL_ORDER_MAX, EVAL_ORDER_MAX);
 		}
 		if (move == killer[0][depth]) {
-			score += 1000; // Killer move bonus
+			score += KILLER1_BONUS; // Killer move bonus
 		} else if (move == killer[1][depth]) {
-			score += 500; // Second killer move bonus
+			score += KILLER2_BONUS; // Second killer move bonus
 		}
 		if (ply && move == cmh[board.side][line[ply-1].src()][line[ply-1].dst()]) {
-			score += 1000; // Counter-move bonus
+			score += COUNTER_BONUS; // Counter-move bonus
 		}
 		scores.push_back({move, score});
 	}
@@ -225,90 +322,151 @@ pzstd::vector<std::pair<Move, Value>> order_moves(Board &board, pzstd::vector<Mo
 	return scores;
 }
 
-Value __recurse(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value beta = VALUE_INFINITE, int side = 1, bool pv = false, int ply = 1) {
-	pvlen[ply] = 0;
+/**
+ * Node types of the main search, resolved at compile time
+ * 
+ * ROOT is the first layer of moves, PV nodes are searched with a full window and lie on
+ * the principal variation, and NON_PV nodes are searched with a null window.
+ */
+enum NodeType { ROOT, PV, NON_PV };
 
-	if (!(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])) {
-		// If black has no king, this is mate for white
-		return (VALUE_MATE) * side;
-	}
-	if (!(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)])) {
-		// Likewise, if white has no king, this is mate for black
-		return (-VALUE_MATE) * side;
-	}
+// Root moves skipped by the current search, which is how MultiPV finds the next best line
+const pzstd::vector<Move> *root_excluded = nullptr;
+// Root move searched first, the move this MultiPV line chose last iteration
+Move root_hint = NullMove;
 
-	// Control on white king and black king respectively. First is white's control, second is that of black
-	auto wcontrol = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)]));
-	auto bcontrol = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)]));
-	
-	if (board.side == WHITE) {
-		// If it is white to move and white controls black's king, it's mate
-		if (bcontrol.first > 0)
-			return VALUE_MATE - 1;
-	} else {
-		// Likewise, the contrary also applies.
-		if (wcontrol.second > 0)
-			return VALUE_MATE - 1;
-	}
+// Null-move pruning is disabled for nmp_side before nmp_min_ply, while a null move cutoff is verified
+int nmp_min_ply = 0;
+bool nmp_side = WHITE;
 
-	// Threefold or 50 move rule
-	if (board.threefold() || board.halfmove >= 100) {
-		return 0;
-	}
+template <NodeType nt>
+Value __recurse(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value beta = VALUE_INFINITE, int ply = 1) {
+	constexpr bool root = nt == ROOT;
+	constexpr bool pv = nt != NON_PV;
+	const int side = board.side == WHITE ? 1 : -1;
+
+	pvlen[ply] = 0;
 
 	bool in_check = false;
-	if (board.side == WHITE) {
-		in_check = wcontrol.second > 0;
-	} else {
-		in_check = bcontrol.first > 0;
-	}
+	if constexpr (!root) {
+		if (!(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])) {
+			// If black has no king, this is mate for white
+			return (VALUE_MATE) * side;
+		}
+		if (!(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)])) {
+			// Likewise, if white has no king, this is mate for black
+			return (-VALUE_MATE) * side;
+		}
 
-	if (in_check) depth++; // Check extensions
+		// Control on white king and black king respectively. First is white's control, second is that of black
+		auto wcontrol = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)]));
+		auto bcontrol = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)]));
+		
+		if (board.side == WHITE) {
+			// If it is white to move and white controls black's king, it's mate
+			if (bcontrol.first > 0)
+				return VALUE_MATE - 1;
+		} else {
+			// Likewise, the contrary also applies.
+			if (wcontrol.second > 0)
+				return VALUE_MATE - 1;
+		}
 
-	if (depth <= 0) {
-		// Reached the maximum depth, perform quiescence search
-		return quiesce(board, alpha, beta, side, ply);
-	}
+		// Repetition, 50 move rule or insufficient material
+		if (board.repetition(ply) || board.halfmove >= 100 || insufficient_material(board)) {
+			return 0;
+		}
 
-	// Check for TTable cutoff
-	TTable::TTEntry *cutoff = board.ttable.probe(board.zobrist, alpha, beta, depth);
-	if (cutoff)
-		return cutoff->eval;
-
-	// Reverse futility pruning
-	if (!in_check && !pv && depth <= 3) {
-		/**
-		 * The idea is that if we are winning by such a large margin that we can afford to lose
-		 * RFP_THRESHOLD * depth eval units per ply, we can return the current eval.
-		 * 
-		 * We need to make sure that we aren't in check (since we might get mated) and that the
-		 * TT entry exists (so that the current position is actually good).
-		 */
-		int cur_eval = eval(board) * side; // TODO: Use the TT entry instead of the eval function?
-		int margin = RFP_THRESHOLD * depth;
-		if (cur_eval >= beta + margin)
-			return cur_eval - margin;
-	}
+		// If we can move back to an earlier position on the line, we can't do worse than a draw
+		if (alpha < 0 && board.upcoming_repetition(ply)) {
+			alpha = 0;
+			if (alpha >= beta)
+				return alpha;
+		}
 
-	// Null-move pruning
-	if (!in_check && _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) >= 8) {
-		/**
-		 * This works off the *null-move observation*.
-		 * 
-		 * The general idea is that a null move will almost always be worse than the best move
-		 * in a given position. So, if we can play a suboptimal move (in this case the null move)
-		 * and still be winning, we were probably winning in the first place.
-		 * 
-		 * The only issue with this approach is that it will fail in Zugzwang positions. There's
-		 * really no good way of preventing this except for disabling NMP in positions where there
-		 * are probably Zugzwangs (e.g. endgames).
-		 */
-		board.make_move(NullMove);
-		// Perform a reduced-depth search
-		Value null_score = -__recurse(board, depth - NMP_R_VALUE, -beta, -beta + 1, -side, pv, ply+1);
-		board.unmake_move();
-		if (null_score >= beta)
-			return null_score;
+		if (board.side == WHITE) {
+			in_check = wcontrol.second > 0;
+		} else {
+			in_check = bcontrol.first > 0;
+		}
+
+		if (in_check) depth++; // Check extensions
+
+		if (depth <= 0) {
+			// Reached the maximum depth, perform quiescence search
+			return quiesce(board, alpha, beta, ply);
+		}
+
+		// Check for TTable cutoff
+		TTable::TTEntry *cutoff = ttable.probe(board.zobrist, alpha, beta, depth);
+		if (cutoff)
+			return cutoff->eval;
+
+		// Static evaluation, shared by the pruning heuristics below
+		const int cur_eval = (!in_check && !pv) ? eval(board) * side : 0;
+
+		// Reverse futility pruning
+		if (!in_check && !pv && depth <= 3) {
+			/**
+			 * The idea is that if we are winning by such a large margin that we can afford to lose
+			 * RFP_THRESHOLD * depth eval units per ply, we can return the current eval.
+			 * 
+			 * We need to make sure that we aren't in check (since we might get mated) and that the
+			 * TT entry exists (so that the current position is actually good).
+			 */
+			int margin = RFP_THRESHOLD * depth;
+			if (cur_eval >= beta + margin)
+				return cur_eval - margin;
+		}
+
+		// Null-move pruning
+		Bitboard ours = board.piece_boards[OCC(board.side)];
+		bool pawn_ending = !(ours & ~(board.piece_boards[PAWN] | board.piece_boards[KING]));
+		bool after_null = line[ply-1] == NullMove;
+		bool nmp_allowed = ply >= nmp_min_ply || board.side != nmp_side;
+		if (!pv && !in_check && !after_null && !pawn_ending && nmp_allowed && cur_eval >= beta
+			&& _mm_popcnt_u64(board.piece_boards[OCC(WHITE)] | board.piece_boards[OCC(BLACK)]) >= 8) {
+			/**
+			 * This works off the *null-move observation*.
+			 * 
+			 * The general idea is that a null move will almost always be worse than the best move
+			 * in a given position. So, if we can play a suboptimal move (in this case the null move)
+			 * and still be winning, we were probably winning in the first place.
+			 * 
+			 * The deeper the search and the further we are above beta, the more we can afford to
+			 * reduce. We never pass twice in a row, and skip pawn endings where the side to move is
+			 * likely to be in Zugzwang.
+			 */
+			int R = NMP_R_VALUE + depth / NMP_DEPTH_DIVISOR + std::min((cur_eval - beta) / NMP_EVAL_DIVISOR, NMP_EVAL_MAX);
+			line[ply] = NullMove;
+			board.make_move(NullMove);
+			// Perform a reduced-depth search
+			Value null_score = -__recurse<NON_PV>(board, depth - R, -beta, -beta + 1, ply+1);
+			board.unmake_move();
+			if (null_score >= beta) {
+				if (null_score >= VALUE_MATE_MAX_PLY)
+					null_score = beta; // Don't trust mate scores from a position where we passed
+
+				if (depth < NMP_VERIFY_DEPTH)
+					return null_score;
+
+				/**
+				 * At high depths, a wrong cutoff in a Zugzwang position is expensive, so we verify it
+				 * with a reduced search of our own moves. NMP is disabled for us in the top of that
+				 * subtree, so that it can't simply confirm itself.
+				 */
+				int outer_min_ply = nmp_min_ply;
+				bool outer_side = nmp_side;
+				nmp_min_ply = ply + 3 * (depth - R) / 4;
+				nmp_side = board.side;
+				Value verify = __recurse<NON_PV>(board, depth - R, beta - 1, beta, ply);
+				// Verifications nest, so give NMP back only as far as the enclosing one allows
+				nmp_min_ply = outer_min_ply;
+				nmp_side = outer_side;
+				if (verify >= beta)
+					return null_score;
+			}
+		}
 	}
 
 	Value best = -VALUE_INFINITE;
@@ -319,19 +477,40 @@ Value __recurse(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value be
 	bool entry_exists = false;
 	pzstd::vector<std::pair<Move, Value>> scores = order_moves(board, moves, side, depth, ply, entry_exists);
 
-	if (depth > 5 && !entry_exists) {
-		depth -= 2; // Internal iterative reductions
+	if constexpr (root) {
+		// Search the move this line chose last iteration first
+		if (root_hint != NullMove) {
+			for (int i = 1; i < scores.size(); i++) {
+				if (scores[i].first == root_hint) {
+					std::rotate(scores.begin(), scores.begin() + i, scores.begin() + i + 1);
+					break;
+				}
+			}
+		}
+	} else {
+		if (depth > 5 && !entry_exists) {
+			depth -= 2; // Internal iterative reductions
+		}
 	}
 
+	// Secondary MultiPV lines don't represent the root position, so keep them out of the TT
+	const bool store = !root || !root_excluded || !root_excluded->size();
+
 	Move best_move = NullMove;
 
-	for (int i = 0; i < moves.size(); i++) {
+	int searched = 0;
+	for (int i = 0; i < moves.size(); i++) { // Skip the TT move if it's not legal
 		Move &move = scores[i].first;
+		if constexpr (root) {
+			if (root_excluded && root_excluded->count(move))
+				continue;
+		}
 		line[ply] = move;
 		board.make_move(move);
+		eval_cache.prefetch(board.zobrist);
 
 		Value score;
-		if (i > 0) {
+		if (searched > 0) {
 			/**
 			 * PV Search (principal variation)
 			 * 
@@ -344,41 +523,48 @@ Value __recurse(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value be
 			 * full-depth re-search. This, however, doesn't happen often enough to slow down
 			 * the search.
 			 */
-			score = -__recurse(board, depth - reduction(i, depth), -alpha - 1, -alpha, -side, 0, ply+1);
+			score = -__recurse<NON_PV>(board, depth - reduction(searched, depth), -alpha - 1, -alpha, ply+1);
 			if (score > alpha) {
-				score = -__recurse(board, depth - 1, -beta, -alpha, -side, 0, ply+1);
+				score = -__recurse<NON_PV>(board, depth - 1, -beta, -alpha, ply+1);
 			}
 		} else {
-			score = -__recurse(board, depth - 1, -beta, -alpha, -side, pv, ply+1);
+			score = -__recurse<pv ? PV : NON_PV>(board, depth - 1, -beta, -alpha, ply+1);
 		}
+		searched++;
 
-		if (abs(score) >= VALUE_MATE_MAX_PLY)
-			score = score - (uint16_t(score >> 15) << 1) - 1; // Mate score fix
+		if constexpr (!root) {
+			if (abs(score) >= VALUE_MATE_MAX_PLY)
+				score = score - (uint16_t(score >> 15) << 1) - 1; // Mate score fix
+		}
 
 		board.unmake_move();
 
 		if (score > best) {
+			// The root always reports a line, even when failing low or high
+			if (root || (score > alpha && score < beta)) {
+				pvtable[ply][0] = move;
+				pvlen[ply] = pvlen[ply+1]+1;
+				for (int i = 0; i < pvlen[ply+1]; i++) {
+					pvtable[ply][i+1] = pvtable[ply+1][i];
+				}
+			}
 			if (score > alpha) {
 				alpha = score;
-				if (score < beta) {
-					pvtable[ply][0] = move;
-					pvlen[ply] = pvlen[ply+1]+1;
-					for (int i = 0; i < pvlen[ply+1]; i++) {
-						pvtable[ply][i+1] = pvtable[ply+1][i];
-					}
-				}
 			}
 			best = score;
 			best_move = move;
 		}
 
 		if (score >= beta) {
-			board.ttable.store(board.zobrist, best, depth, LOWER_BOUND, best_move, board.halfmove);
+			if (store)
+				ttable.store(board.zobrist, best, depth, LOWER_BOUND, best_move, board.halfmove);
 			killer[1][depth] = killer[0][depth];
 			killer[0][depth] = move; // Update killer moves
-			if (!(board.piece_boards[OPPOCC(board.side)] & square_bits(move.dst()))) { // Not a capture
-				history[board.side][move.src()][move.dst()] += depth * depth;
-				cmh[board.side][line[ply-1].src()][line[ply-1].dst()] = move; // Update counter-move history
+			if constexpr (!root) {
+				if (!(board.piece_boards[OPPOCC(board.side)] & square_bits(move.dst()))) { // Not a capture
+					history[board.side][move.src()][move.dst()] += depth * depth;
+					cmh[board.side][line[ply-1].src()][line[ply-1].dst()] = move; // Update counter-move history
+				}
 			}
 			return best;
 		}
@@ -387,103 +573,92 @@ Value __recurse(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value be
 			break;
 	}
 
-	// Stalemate detection
-	if (best == -VALUE_MATE + 2) {
-		// If our engine thinks we are mated but we are not in check, we are stalemated
-		// TODO: Is this buggy?
-		if (board.side == WHITE) {
-			if (!board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)])).second)
-				best = 0;
-		} else {
-			if (!board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])).first)
-				best = 0;
+	if constexpr (!root) {
+		// Stalemate detection
+		if (best == -VALUE_MATE + 2) {
+			// If our engine thinks we are mated but we are not in check, we are stalemated
+			// TODO: Is this buggy?
+			if (board.side == WHITE) {
+				if (!board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(WHITE)])).second)
+					best = 0;
+			} else {
+				if (!board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(BLACK)])).first)
+					best = 0;
+			}
 		}
 	}
 
-	if (best <= alpha) {
-		board.ttable.store(board.zobrist, alpha, depth, UPPER_BOUND, best_move, board.halfmove);
+	if (!store) {
+		// Don't store
+	} else if (best <= alpha) {
+		ttable.store(board.zobrist, alpha, depth, UPPER_BOUND, best_move, board.halfmove);
 	} else {
-		board.ttable.store(board.zobrist, best, depth, EXACT, best_move, board.halfmove);
+		ttable.store(board.zobrist, best, depth, EXACT, best_move, board.halfmove);
 	}
 
 	return best;
 }
 
 // Search function from the first layer of moves
-std::pair<Move, Value> __search(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value beta = VALUE_INFINITE, int side = 1) {
-	Move best_move = NullMove;
-	Value best_score = -VALUE_INFINITE;
-
-	pzstd::vector<Move> moves;
-	board.legal_moves(moves);
-
-	bool entry_exists = false;
-	pzstd::vector<std::pair<Move, Value>> scores = order_moves(board, moves, side, depth, 0, entry_exists);
-
-	for (int i = 0; i < moves.size(); i++) { // Skip the TT move if it's not legal
-		Move &move = scores[i].first;
-		line[0] = move;
-		board.make_move(move);
-		Value score;
-		if (i > 0) {
-			score = -__recurse(board, depth - reduction(i, depth), -alpha - 1, -alpha, -side);
-			if (score > alpha) {
-				score = -__recurse(board, depth - 1, -beta, -alpha, -side);
-			}
-		} else {
-			score = -__recurse(board, depth - 1, -beta, -alpha, -side, 1);
-		}
-
-		board.unmake_move();
-
-		if (score > best_score) {
-			pvtable[0][0] = move;
-			pvlen[0] = pvlen[1]+1;
-			for (int i = 0; i < pvlen[1]; i++) {
-				pvtable[0][i+1] = pvtable[1][i];
-			}
-			if (score > alpha) {
-				alpha = score;
-			}
-			best_score = score;
-			best_move = move;
-		}
-
-		if (score >= beta) {
-			board.ttable.store(board.zobrist, best_score, depth, LOWER_BOUND, best_move, board.halfmove);
-			killer[1][depth] = killer[0][depth];
-			killer[0][depth] = move;
-			return {best_move, best_score};
-		}
+// Moves in `excluded` are skipped, which is how MultiPV finds the next best line
+std::pair<Move, Value> __search(Board &board, int depth, Value alpha = -VALUE_INFINITE, Value beta = VALUE_INFINITE, const pzstd::vector<Move> &excluded = {}, Move hint = NullMove) {
+	root_excluded = &excluded;
+	root_hint = hint;
+	Value score = __recurse<ROOT>(board, depth, alpha, beta, 0);
+	root_excluded = nullptr;
+	return {pvlen[0] ? pvtable[0][0] : NullMove, score};
+}
 
-		if (early_exit)
-			break;
+/**
+ * MultiPV state
+ * 
+ * Every line k stores the PV found for the k-th best root move, along with its score, so
+ * that the next iteration can center its aspiration window on it and search its move first.
+ */
+int multipv = 1;
+Move mpv_table[MAX_MULTIPV][MAX_PLY];
+int mpv_len[MAX_MULTIPV];
+Value mpv_score[MAX_MULTIPV];
+
+void __print_pv(int k, bool omit_last = 0) { // Need to omit last to prevent illegal moves during mates
+	for (int i = 0; i < mpv_len[k] - omit_last; i++) {
+		if (mpv_table[k][i] == NullMove) break;
+		std::cout << mpv_table[k][i].to_string() << ' ';
 	}
+}
 
-	if (best_score <= alpha) {
-		board.ttable.store(board.zobrist, alpha, depth, UPPER_BOUND, best_move, board.halfmove);
+void __print_info(int d, int k) {
+	Value eval = mpv_score[k];
+	std::cout << "info depth " << d << " seldepth " << seldepth << " multipv " << k + 1;
+	if (abs(eval) >= VALUE_MATE_MAX_PLY) {
+		std::cout << " score mate " << (VALUE_MATE - abs(eval)) / 2 * (eval > 0 ? 1 : -1) << " nodes " << nodes << " nps "
+				  << (nodes / ((double)(clock() - start) / CLOCKS_PER_SEC)) << " pv ";
+		__print_pv(k, 1);
 	} else {
-		board.ttable.store(board.zobrist, best_score, depth, EXACT, best_move, board.halfmove);
+		std::cout << " score cp " << eval / CP_SCALE_FACTOR << " nodes " << nodes << " nps " << (nodes / ((double)(clock() - start) / CLOCKS_PER_SEC))
+				  << " pv ";
+		__print_pv(k);
 	}
-
-	return {best_move, best_score};
+	std::cout << "hashfull " << (ttable.size() * 1000 / ttable.mxsize()) << " time " << (clock() - start) / CLOCKS_PER_MS << std::endl;
 }
 
-void __print_pv(bool omit_last = 0) { // Need to omit last to prevent illegal moves during mates
-	const int ROOT_PLY = 0;
-	for (int i = 0; i < pvlen[ROOT_PLY] - omit_last; i++) {
-		if (pvtable[ROOT_PLY][i] == NullMove) break;
-		std::cout << pvtable[ROOT_PLY][i].to_string() << ' ';
+// Number of root moves that don't leave our own king in check
+int __count_root_moves(Board &board) {
+	pzstd::vector<Move> moves;
+	board.legal_moves(moves);
+	int cnt = 0;
+	for (Move &move : moves) {
+		board.make_move(move);
+		Bitboard king = board.piece_boards[KING] & board.piece_boards[OPPOCC(board.side)];
+		auto control = board.control(__tzcnt_u64(king));
+		if (!(board.side == WHITE ? control.first : control.second))
+			cnt++;
+		board.unmake_move();
 	}
+	return cnt;
 }
 
-std::pair<Move, Value> search(Board &board, int64_t time, bool quiet) {
-	std::cout << std::fixed << std::setprecision(0);
-	nodes = seldepth = 0;
-	early_exit = exit_allowed = false;
-	start = clock();
-	mxtime = time;
-	
+void __clear_tables() {
 	// Clear killer moves and history heuristic
 	for (int i = 0; i < MAX_PLY; i++) {
 		killer[0][i] = killer[1][i] = NullMove;
@@ -496,12 +671,25 @@ std::pair<Move, Value> search(Board &board, int64_t time, bool quiet) {
 		}
 	}
 
-	Move best_move = NullMove;
-	Value eval = -VALUE_INFINITE;
-	bool aspiration_enabled = true;
-	for (int d = 1; d <= MAX_PLY; d++) {
+	for (int k = 0; k < MAX_MULTIPV; k++) {
+		mpv_len[k] = 0;
+		mpv_score[k] = -VALUE_INFINITE;
+	}
+}
+
+/**
+ * Run one iteration of iterative deepening, searching `lines` principal variations.
+ * 
+ * Each line gets its own aspiration window, and excludes the moves of the lines found before it
+ * in this iteration. The TT, killers and history are shared between all lines.
+ * 
+ * Returns false if the search was stopped before the first line completed.
+ */
+bool __iterate(Board &board, int d, int lines, bool quiet) {
+	pzstd::vector<Move> excluded;
+	for (int k = 0; k < lines; k++) {
 		Value alpha = -VALUE_INFINITE, beta = VALUE_INFINITE;
-		if (eval != -VALUE_INFINITE && aspiration_enabled) {
+		if (mpv_score[k] != -VALUE_INFINITE) {
 			/**
 			 * Aspiration windows work by searching a small window around the expected value
 			 * of the position. By having a smaller window, our search runs faster. 
@@ -513,10 +701,11 @@ std::pair<Move, Value> search(Board &board, int64_t time, bool quiet) {
 			 * - Incremental window size, i.e. we don't search to VALUE_INFINITE but instead 
 			 * gradually increase the window size
 			 */
-			alpha = eval - ASPIRATION_WINDOW;
-			beta = eval + ASPIRATION_WINDOW;
+			alpha = mpv_score[k] - ASPIRATION_WINDOW;
+			beta = mpv_score[k] + ASPIRATION_WINDOW;
 		}
-		auto result = __search(board, d, alpha, beta, board.side ? -1 : 1);
+		Move hint = mpv_len[k] ? mpv_table[k][0] : NullMove;
+		auto result = __search(board, d, alpha, beta, excluded, hint);
 		// Check for fail-high or fail-low
 		bool research = result.second >= beta || result.second <= alpha;
 		if (result.second >= beta) {
@@ -527,37 +716,55 @@ std::pair<Move, Value> search(Board &board, int64_t time, bool quiet) {
 		}
 		if (research) {
 			// If we failed, re-search
-			result = __search(board, d, alpha, beta, board.side ? -1 : 1);
+			result = __search(board, d, alpha, beta, excluded, hint);
 		}
 		if (early_exit)
-			break;
-		eval = result.second;
-		best_move = result.first;
+			return k > 0;
+
+		mpv_score[k] = result.second;
+		mpv_len[k] = pvlen[0];
+		for (int i = 0; i < pvlen[0]; i++) {
+			mpv_table[k][i] = pvtable[0][i];
+		}
+		excluded.push_back(result.first);
 
 		seldepth = std::max(seldepth, d);
 
 #ifndef NOUCI
-		if (!quiet) {
-			if (abs(eval) >= VALUE_MATE_MAX_PLY) {
-				std::cout << "info depth " << d << " seldepth " << seldepth << " score mate " << (VALUE_MATE - abs(eval)) / 2 * (eval > 0 ? 1 : -1) << " nodes "
-						<< nodes << " nps " << (nodes / ((double)(clock() - start) / CLOCKS_PER_SEC)) << " pv ";
-				__print_pv(1);
-				std::cout << "hashfull " << (board.ttable.size() * 1000 / board.ttable.mxsize()) << " time " << (clock() - start) / CLOCKS_PER_MS << std::endl;
-			} else {
-				std::cout << "info depth " << d << " seldepth " << seldepth << " score cp " << eval / CP_SCALE_FACTOR << " nodes " << nodes << " nps "
-						<< (nodes / ((double)(clock() - start) / CLOCKS_PER_SEC)) << " pv ";
-				__print_pv();
-				std::cout << "hashfull " << (board.ttable.size() * 1000 / board.ttable.mxsize()) << " time " << (clock() - start) / CLOCKS_PER_MS << std::endl;
-			}
-		}
+		if (!quiet)
+			__print_info(d, k);
 #endif
+	}
+	return true;
+}
+
+std::pair<Move, Value> search(Board &board, int64_t time, bool quiet) {
+	std::cout << std::fixed << std::setprecision(0);
+	nodes = seldepth = 0;
+	early_exit = exit_allowed = false;
+	start = clock();
+	mxtime = time;
+	
+	__clear_tables();
+	int lines = std::max(1, std::min(multipv, __count_root_moves(board)));
+
+	Move best_move = NullMove;
+	Value eval = -VALUE_INFINITE;
+	for (int d = 1; d <= MAX_PLY; d++) {
+		if (!__iterate(board, d, lines, quiet))
+			break;
+		eval = mpv_score[0];
+		best_move = mpv_table[0][0];
 
 		exit_allowed = true;
 
-		if (abs(eval) >= VALUE_MATE_MAX_PLY) {
+		if (lines == 1 && abs(eval) >= VALUE_MATE_MAX_PLY) {
 			return {best_move, eval};
 			// We don't need to search further, we found mate
 		}
+
+		if (early_exit)
+			break;
 	}
 
 	return {best_move, eval / CP_SCALE_FACTOR};
@@ -570,61 +777,19 @@ std::pair<Move, Value> search_depth(Board &board, int depth, bool quiet) {
 	early_exit = exit_allowed = false;
 	start = clock();
 
-	// Clear killer moves and history heuristic
-	for (int i = 0; i < MAX_PLY; i++) {
-		killer[0][i] = killer[1][i] = NullMove;
-		pvlen[i] = 0;
-	}
-
-	for (int i = 0; i < 64; i++) {
-		for (int j = 0; j < 64; j++) {
-			history[0][i][j] = history[1][i][j] = 0;
-		}
-	}
+	__clear_tables();
+	int lines = std::max(1, std::min(multipv, __count_root_moves(board)));
 
 	Move best_move = NullMove;
 	Value eval = -VALUE_INFINITE;
-	bool aspiration_enabled = true;
 	for (int d = 1; d <= depth; d++) {
-		Value alpha = -VALUE_INFINITE, beta = VALUE_INFINITE;
-		if (eval != -VALUE_INFINITE && aspiration_enabled) {
-			alpha = eval - ASPIRATION_WINDOW;
-			beta = eval + ASPIRATION_WINDOW;
-		}
-		auto result = __search(board, d, alpha, beta, board.side ? -1 : 1);
-		// Check for fail-high or fail-low
-		bool research = result.second >= beta || result.second <= alpha;
-		if (result.second >= beta) {
-			beta = VALUE_INFINITE;
-		}
-		if (result.second <= alpha) {
-			alpha = -VALUE_INFINITE;
-		}
-		if (research) {
-			result = __search(board, d, alpha, beta, board.side ? -1 : 1);
-		}
-		if (early_exit)
+		if (!__iterate(board, d, lines, quiet))
 			break;
-		eval = result.second;
-		best_move = result.first;
+		eval = mpv_score[0];
+		best_move = mpv_table[0][0];
 
-		seldepth = std::max(seldepth, d);
-
-#ifndef NOUCI
-		if (!quiet) {
-			if (abs(eval) >= VALUE_MATE_MAX_PLY) {
-				std::cout << "info depth " << d << " seldepth " << seldepth << " score mate " << (VALUE_MATE - abs(eval)) / 2 * (eval > 0 ? 1 : -1) << " nodes "
-						<< nodes << " nps " << (nodes / ((double)(clock() - start) / CLOCKS_PER_SEC)) << " pv ";
-				__print_pv(1);
-				std::cout << "hashfull " << (board.ttable.size() * 1000 / board.ttable.mxsize()) << " time " << (clock() - start) / CLOCKS_PER_MS << std::endl;
-			} else {
-				std::cout << "info depth " << d << " seldepth " << seldepth << " score cp " << eval / CP_SCALE_FACTOR << " nodes " << nodes << " nps "
-						<< (nodes / ((double)(clock() - start) / CLOCKS_PER_SEC)) << " pv ";
-				__print_pv();
-				std::cout << "hashfull " << (board.ttable.size() * 1000 / board.ttable.mxsize()) << " time " << (clock() - start) / CLOCKS_PER_MS << std::endl;
-			}
-		}
-#endif
+		if (early_exit)
+			break;
 	}
 
 	return {best_move, eval / CP_SCALE_FACTOR};
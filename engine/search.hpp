@@ -1,9 +1,11 @@
 #pragma once
 
 #include "bitboard.hpp"
+#include "endgame.hpp"
 #include "eval.hpp"
 #include "movegen.hpp"
 #include "ttable.hpp"
+#include "tune.hpp"
 #include <algorithm>
 
 // Eval per ply threshold for RFP
@@ -11,24 +13,58 @@
 // we can afford to lose RFP_THRESHOLD eval units per ply
 // and still be in a better position. The lower the value,
 // the more aggressive RFP is.
-#define RFP_THRESHOLD (150 * CP_SCALE_FACTOR)
+TUNABLE(RFP_THRESHOLD, 150 * CP_SCALE_FACTOR, 0, 400 * CP_SCALE_FACTOR);
 
 // Aspiration window size(s)
 // The aspiration window is the range of values we search
 // for the best move. If we fail to find the best move in
 // this range, we expand the window.
-#define ASPIRATION_WINDOW (50 * CP_SCALE_FACTOR)
+TUNABLE(ASPIRATION_WINDOW, 50 * CP_SCALE_FACTOR, 5 * CP_SCALE_FACTOR, 200 * CP_SCALE_FACTOR);
 
 // Null-move pruning reduction value
 // This is the amount of depth we reduce the search by
 // when we do a null-move search
-#define NMP_R_VALUE 3
+TUNABLE(NMP_R_VALUE, 3, 1, 6);
+
+// Adaptive null-move reduction
+// One extra ply of reduction every NMP_DEPTH_DIVISOR plies of depth, and
+// every NMP_EVAL_DIVISOR eval units above beta (at most NMP_EVAL_MAX plies)
+TUNABLE(NMP_DEPTH_DIVISOR, 4, 2, 8);
+TUNABLE(NMP_EVAL_DIVISOR, 200 * CP_SCALE_FACTOR, 50 * CP_SCALE_FACTOR, 500 * CP_SCALE_FACTOR);
+TUNABLE(NMP_EVAL_MAX, 3, 0, 6);
+
+// Minimum depth at which null-move cutoffs are verified against Zugzwang
+TUNABLE(NMP_VERIFY_DEPTH, 10, 4, 20);
 
 // Delta pruning threshold
 // This is the threshold for delta pruning (in centipawns)
-#define DELTA_THRESHOLD (300 * CP_SCALE_FACTOR)
+TUNABLE(DELTA_THRESHOLD, 300 * CP_SCALE_FACTOR, 0, 1000 * CP_SCALE_FACTOR);
+
+// Minimum game phase (see PhaseValue) for delta pruning
+// Below it, a single capture is too likely to decide the game
+TUNABLE(DELTA_MIN_PHASE, 4, 0, MAX_PHASE);
+
+// Late-move reduction constants, in hundredths
+// The reduction is LMR_BASE + log2(i) * log2(d) / LMR_DIVISOR
+TUNABLE(LMR_BASE, 77, 0, 200);
+TUNABLE(LMR_DIVISOR, 236, 100, 500);
 
+// Minimum depth at which quiet moves are also ordered by their static eval,
+// which is clamped to +-EVAL_ORDER_MAX so that it can't drown out the other bonuses
+TUNABLE(EVAL_ORDER_DEPTH, 8, 1, 64);
+TUNABLE(EVAL_ORDER_MAX, 500 * CP_SCALE_FACTOR, 0, 2000 * CP_SCALE_FACTOR);
+
+// Move ordering bonuses for killer and counter moves
+TUNABLE(KILLER1_BONUS, 1000, 0, 4000);
+TUNABLE(KILLER2_BONUS, 500, 0, 4000);
+TUNABLE(COUNTER_BONUS, 1000, 0, 4000);
+
+// Maximum number of principal variations reported in MultiPV mode
+#define MAX_MULTIPV 64
+
+extern TTable ttable; // Shared by every search, sized with the Hash option
 extern uint64_t nodes;
+extern int multipv;
 
 std::pair<Move, Value> search(Board &board, int64_t time = 1e9, bool quiet = false);
 
@@ -37,3 +73,6 @@ std::pair<Move, Value> search_depth(Board &board, int depth, bool quiet = false)
 std::pair<Move, Value> search_nodes(Board &board, uint64_t nodes);
 
 uint64_t perft(Board &board, int depth);
+
+// Speed of move generation, attack lookups and perft, for comparing slider table layouts
+void bench_movegen();
@@ -0,0 +1,295 @@
+#include "includes.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bitboard.hpp"
+#include "endgame.hpp"
+#include "movegen.hpp"
+
+// SPSA tuning driver
+// Plays fixed-node self-play games between two perturbed parameter sets of a TUNE build
+// (`make tune`) over UCI, and moves the parameters in the direction of the winner.
+//
+// Usage: ./spsa <engine> [iterations] [game pairs per iteration] [nodes per move] [threads]
+
+#define OPENING_PLIES 8 // Random plies played before each game pair
+#define MAX_GAME_PLIES 400 // Adjudicate as a draw after this many plies
+
+// SPSA hyperparameters, following the OpenBench conventions
+#define SPSA_ALPHA 0.602
+#define SPSA_GAMMA 0.101
+#define SPSA_R_END 0.002
+
+struct SpsaParam {
+	std::string name;
+	double value;
+	int min, max;
+	double c_end;
+};
+
+// A child engine process we talk to over pipes
+class EngineProcess {
+private:
+	pid_t pid;
+	FILE *in, *out;
+
+public:
+	EngineProcess(const std::string &path) {
+		int to_child[2], from_child[2];
+		if (pipe(to_child) || pipe(from_child)) {
+			perror("pipe");
+			exit(1);
+		}
+		pid = fork();
+		if (pid == 0) {
+			dup2(to_child[0], STDIN_FILENO);
+			dup2(from_child[1], STDOUT_FILENO);
+			close(to_child[1]);
+			close(from_child[0]);
+			execl(path.c_str(), path.c_str(), (char *)nullptr);
+			perror("execl");
+			_exit(1);
+		}
+		close(to_child[0]);
+		close(from_child[1]);
+		in = fdopen(to_child[1], "w");
+		out = fdopen(from_child[0], "r");
+	}
+
+	~EngineProcess() {
+		send("quit");
+		fclose(in);
+		fclose(out);
+		waitpid(pid, nullptr, 0);
+	}
+
+	void send(const std::string &line) {
+		fputs((line + "\n").c_str(), in);
+		fflush(in);
+	}
+
+	// Reads lines until one starts with `prefix`, and returns it
+	std::string wait_for(const std::string &prefix) {
+		char buf[4096];
+		while (fgets(buf, sizeof(buf), out)) {
+			std::string line(buf);
+			if (line.compare(0, prefix.size(), prefix) == 0)
+				return line;
+		}
+		std::cerr << "Engine exited unexpectedly" << std::endl;
+		exit(1);
+	}
+
+	void set_params(const std::vector<SpsaParam> &params, const std::vector<int> &values) {
+		for (size_t i = 0; i < params.size(); i++) {
+			send("setoption name " + params[i].name + " value " + std::to_string(values[i]));
+		}
+		send("ucinewgame");
+		send("isready");
+		wait_for("readyok");
+	}
+};
+
+// Non-tunable options the engine also advertises
+bool skip_option(const std::string &name) {
+	return name == "Hash" || name == "Threads" || name == "MultiPV" || name == "EvalCache";
+}
+
+// Read the tunable parameters from the engine's `uci` output
+std::vector<SpsaParam> discover_params(const std::string &path) {
+	EngineProcess engine(path);
+	engine.send("uci");
+	std::vector<SpsaParam> params;
+	while (true) {
+		std::string line = engine.wait_for("");
+		if (line.compare(0, 5, "uciok") == 0)
+			break;
+		std::stringstream ss(line);
+		std::string token, name, type;
+		int def = 0, mn = 0, mx = 0;
+		ss >> token;
+		if (token != "option")
+			continue;
+		while (ss >> token) {
+			if (token == "name")
+				ss >> name;
+			else if (token == "type")
+				ss >> type;
+			else if (token == "default")
+				ss >> def;
+			else if (token == "min")
+				ss >> mn;
+			else if (token == "max")
+				ss >> mx;
+		}
+		if (type != "spin" || skip_option(name))
+			continue;
+		params.push_back({name, (double)def, mn, mx, std::max(0.5, (mx - mn) / 20.0)});
+	}
+	return params;
+}
+
+// Whether the side to move is in check
+bool in_check(const Board &board) {
+	auto control = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OCC(board.side)]));
+	return board.side == WHITE ? control.second : control.first;
+}
+
+void strictly_legal_moves(Board &board, pzstd::vector<Move> &legal) {
+	pzstd::vector<Move> moves;
+	board.legal_moves(moves);
+	for (Move &move : moves) {
+		board.make_move(move);
+		auto control = board.control(__tzcnt_u64(board.piece_boards[KING] & board.piece_boards[OPPOCC(board.side)]));
+		if (!(board.side == WHITE ? control.first : control.second))
+			legal.push_back(move);
+		board.unmake_move();
+	}
+}
+
+// Plays one game from the opening, returns the result from white's point of view (1, 0 or -1)
+int play_game(EngineProcess &white, EngineProcess &black, const std::vector<Move> &opening, uint64_t nodes) {
+	Board board;
+	std::string moves = "";
+	for (Move move : opening) {
+		moves += " " + move.to_string();
+		board.make_move(move);
+	}
+	for (int ply = 0; ply < MAX_GAME_PLIES; ply++) {
+		pzstd::vector<Move> legal;
+		strictly_legal_moves(board, legal);
+		if (legal.size() == 0)
+			return in_check(board) ? (board.side == WHITE ? -1 : 1) : 0;
+		if (board.repetition() || board.halfmove >= 100)
+			return 0;
+		if (insufficient_material(board))
+			return 0;
+
+		EngineProcess &engine = board.side == WHITE ? white : black;
+		engine.send("position startpos moves" + moves);
+		engine.send("go nodes " + std::to_string(nodes));
+		std::stringstream ss(engine.wait_for("bestmove"));
+		std::string token, movestr;
+		ss >> token >> movestr;
+		Move move = Move::from_string(movestr, &board);
+		bool found = false;
+		for (Move &m : legal)
+			found |= m == move;
+		if (!found) // Illegal move loses
+			return board.side == WHITE ? -1 : 1;
+		moves += " " + movestr;
+		board.make_move(move);
+	}
+	return 0;
+}
+
+std::vector<Move> random_opening(std::mt19937 &rng) {
+	while (true) {
+		Board board;
+		std::vector<Move> opening;
+		for (int i = 0; i < OPENING_PLIES; i++) {
+			pzstd::vector<Move> legal;
+			strictly_legal_moves(board, legal);
+			if (legal.size() == 0)
+				break;
+			Move move = legal[rng() % legal.size()];
+			opening.push_back(move);
+			board.make_move(move);
+		}
+		if (opening.size() == OPENING_PLIES)
+			return opening;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		std::cout << "Usage: " << argv[0] << " <engine> [iterations] [game pairs per iteration] [nodes per move] [threads]" << std::endl;
+		return 1;
+	}
+	std::string path = argv[1];
+	int iterations = argc > 2 ? std::stoi(argv[2]) : 1000;
+	int pairs = argc > 3 ? std::stoi(argv[3]) : 8;
+	uint64_t nodes = argc > 4 ? std::stoull(argv[4]) : 5000;
+	int nthreads = argc > 5 ? std::stoi(argv[5]) : std::thread::hardware_concurrency();
+
+	std::vector<SpsaParam> params = discover_params(path);
+	if (params.empty()) {
+		std::cerr << "No tunable options found, is " << path << " a TUNE build?" << std::endl;
+		return 1;
+	}
+	std::cout << "PZChessBot " << VERSION << " SPSA tuner: " << params.size() << " parameters, " << iterations << " iterations of " << pairs
+			  << " game pairs at " << nodes << " nodes per move on " << nthreads << " threads" << std::endl;
+
+	double A = iterations * 0.1;
+	std::vector<double> a(params.size()), c(params.size());
+	for (size_t i = 0; i < params.size(); i++) {
+		c[i] = params[i].c_end * pow(iterations, SPSA_GAMMA);
+		a[i] = SPSA_R_END * params[i].c_end * params[i].c_end * pow(A + iterations, SPSA_ALPHA);
+	}
+
+	// Each worker keeps its own pair of engines for the whole run
+	std::vector<std::unique_ptr<EngineProcess>> engines;
+	for (int t = 0; t < 2 * nthreads; t++)
+		engines.emplace_back(new EngineProcess(path));
+
+	std::mt19937 rng(time(NULL));
+	for (int k = 0; k < iterations; k++) {
+		// Perturb every parameter by +-c_k
+		std::vector<int> plus(params.size()), minus(params.size());
+		std::vector<double> ck(params.size()), delta(params.size());
+		for (size_t i = 0; i < params.size(); i++) {
+			ck[i] = c[i] / pow(k + 1, SPSA_GAMMA);
+			delta[i] = (rng() & 1) ? 1 : -1;
+			plus[i] = std::clamp((int)lround(params[i].value + ck[i] * delta[i]), params[i].min, params[i].max);
+			minus[i] = std::clamp((int)lround(params[i].value - ck[i] * delta[i]), params[i].min, params[i].max);
+		}
+
+		std::vector<std::vector<Move>> openings;
+		for (int p = 0; p < pairs; p++)
+			openings.push_back(random_opening(rng));
+
+		// Play the game pairs in parallel, each opening once with either color
+		std::atomic<int> next(0), score(0);
+		std::vector<std::thread> workers;
+		for (int t = 0; t < nthreads; t++) {
+			workers.emplace_back([&, t] {
+				EngineProcess &eplus = *engines[2 * t], &eminus = *engines[2 * t + 1];
+				for (int p; (p = next++) < pairs;) {
+					eplus.set_params(params, plus);
+					eminus.set_params(params, minus);
+					score += play_game(eplus, eminus, openings[p], nodes);
+					eplus.set_params(params, plus);
+					eminus.set_params(params, minus);
+					score -= play_game(eminus, eplus, openings[p], nodes);
+				}
+			});
+		}
+		for (auto &worker : workers)
+			worker.join();
+
+		// Step towards the better parameter set
+		for (size_t i = 0; i < params.size(); i++) {
+			double ak = a[i] / pow(A + k + 1, SPSA_ALPHA);
+			double rk = ak / (ck[i] * ck[i]);
+			params[i].value = std::clamp(params[i].value + rk * ck[i] * score * delta[i], (double)params[i].min, (double)params[i].max);
+		}
+
+		std::cout << "Iteration " << k + 1 << " score " << score << ":";
+		for (SpsaParam &param : params)
+			std::cout << ' ' << param.name << '=' << std::fixed << std::setprecision(2) << param.value;
+		std::cout << std::endl;
+	}
+
+	std::cout << "Final values:" << std::endl;
+	for (SpsaParam &param : params)
+		std::cout << param.name << ", " << lround(param.value) << std::endl;
+	return 0;
+}
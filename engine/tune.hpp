@@ -0,0 +1,36 @@
+#pragma once
+
+#include "includes.hpp"
+
+#include <vector>
+
+/**
+ * Tunable search parameters
+ *
+ * In regular builds, every TUNABLE is a constexpr int, so the compiler folds it exactly like
+ * the #define it replaced. Building with -DTUNE turns them into globals that are registered
+ * here and exposed as UCI spin options, so that the SPSA driver (spsa.cc) can change them
+ * between games without recompiling.
+ */
+#ifdef TUNE
+struct TuneParam {
+	const char *name;
+	int &value;
+	int min, max;
+};
+
+inline std::vector<TuneParam> &tune_params() {
+	static std::vector<TuneParam> params;
+	return params;
+}
+
+struct TuneRegister {
+	TuneRegister(const char *name, int &value, int min, int max) { tune_params().push_back({name, value, min, max}); }
+};
+
+#define TUNABLE(name, def, min, max)                                                                                                                           \
+	inline int name = (def);                                                                                                                                   \
+	inline TuneRegister name##_REGISTER(#name, name, (min), (max))
+#else
+#define TUNABLE(name, def, min, max) constexpr int name = (def)
+#endif
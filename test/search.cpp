@@ -1,5 +1,9 @@
+#include "../engine/mate.hpp"
 #include "../engine/search.hpp"
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <vector>
 
 bool failed = false;
@@ -17,10 +21,183 @@ std::vector<std::tuple<std::string, int, std::string>> tests = {
 	{"7k/8/5K2/6Q1/8/8/P1P2P1P/8 w - - 3 41", 6, "g5g7"}, // M1 (stalemate trick)
 };
 
+// Mate solver: position, maximum mate length, expected move and mate length ("0000" when there is no mate)
+std::vector<std::tuple<std::string, int, std::string, int>> mate_tests = {
+	{"7k/8/5K2/8/8/8/8/6Q1 w - - 0 1", 3, "g1g7", 1}, // M1
+	{"r2qkr2/1b1pn1b1/p5pp/3N4/2B5/5Q2/PPP3PP/R4RK1 w q - 2 20", 3, "f3f8", 2}, // M2
+	{"7k/6Q1/6K1/8/8/8/8/8 b - - 0 1", 3, "0000", 0}, // Checkmated root
+	{"7k/8/6QK/8/8/8/8/8 b - - 0 1", 3, "0000", 0}, // Stalemated root
+	{"7k/8/8/8/8/8/8/K5Q1 w - - 0 1", 1, "0000", 0}, // No mate within the limit
+};
+
+void check(int &i, bool ok, const std::string &what) {
+	if (ok) {
+		std::cout << "Passed test " << i << " - " << what << std::endl;
+	} else {
+		std::cout << "Failed test " << i << " - " << what << std::endl;
+		failed = true;
+	}
+	i++;
+}
+
+Board play(const std::string &fen, const std::vector<std::string> &moves) {
+	Board board(fen);
+	for (const std::string &move : moves)
+		board.make_move(Move::from_string(move, &board));
+	return board;
+}
+
+// The TT and the eval cache are global, so every test starts from empty ones
+void clear_state() {
+	ttable.clear();
+	eval_cache.clear();
+}
+
+const std::string STARTPOS = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+const std::string MIDGAME = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+
+void test_repetition(int &i) {
+	Board once = play(STARTPOS, {"g1f3", "g8f6", "f3g1", "f6g8"});
+	check(i, !once.repetition(), "startpos repeated once is not a draw");
+	Board twice = play(STARTPOS, {"g1f3", "g8f6", "f3g1", "f6g8", "g1f3", "g8f6", "f3g1", "f6g8"});
+	check(i, twice.repetition(), "startpos repeated twice is a draw");
+	check(i, once.repetition(5), "a repetition inside the search is a draw");
+
+	// After Nf3 Nf6 Ng1, black can go back to the position 3 plies ago
+	Board board = play(STARTPOS, {"g1f3", "g8f6", "f3g1"});
+	check(i, board.upcoming_repetition(4), "upcoming repetition of a position after the root");
+	check(i, !board.upcoming_repetition(3), "no upcoming repetition of a position before the root");
+	Board blocked = play(STARTPOS, {"g1f3", "g8f6", "f3g1", "f6e4"});
+	check(i, !blocked.upcoming_repetition(10), "no upcoming repetition without a move back");
+}
+
+void test_multipv(int &i) {
+	// Capture the info lines of a depth 5 search with 3 lines
+	std::ostringstream out;
+	std::streambuf *old = std::cout.rdbuf(out.rdbuf());
+	Board board(MIDGAME);
+	multipv = 3;
+	std::pair<Move, Value> res = search_depth(board, 5);
+	multipv = 1;
+	std::cout.rdbuf(old);
+
+	std::string line, token, moves[3];
+	int scores[3] = {};
+	std::istringstream lines(out.str());
+	while (std::getline(lines, line)) {
+		std::istringstream ss(line);
+		int k = 0, score = 0;
+		std::string move;
+		while (ss >> token) {
+			if (token == "multipv")
+				ss >> k;
+			else if (token == "cp")
+				ss >> score;
+			else if (token == "pv")
+				ss >> move;
+		}
+		if (k >= 1 && k <= 3 && line.find("info depth 5 ") == 0) {
+			moves[k - 1] = move;
+			scores[k - 1] = score;
+		}
+	}
+	bool distinct = !moves[0].empty() && !moves[1].empty() && !moves[2].empty() && moves[0] != moves[1] && moves[1] != moves[2] &&
+					moves[0] != moves[2];
+	check(i, distinct && scores[0] >= scores[1] && scores[1] >= scores[2] && moves[0] == res.first.to_string(),
+		  "multipv 3 reports 3 different moves, best first");
+}
+
+void test_endgames(int &i) {
+	check(i, insufficient_material(Board("8/8/3k4/8/8/3K4/8/8 w - - 0 1")), "KvK is insufficient material");
+	check(i, insufficient_material(Board("8/8/3k4/8/8/3K4/8/5b2 w - - 0 1")), "KvKB is insufficient material");
+	check(i, insufficient_material(Board("8/8/3k4/8/8/3K4/8/5N2 b - - 0 1")), "KNvK is insufficient material");
+	check(i, !insufficient_material(Board("8/8/3k4/8/8/3K4/4P3/8 w - - 0 1")), "KPvK is not insufficient material");
+	check(i, !insufficient_material(Board("8/8/3k4/8/8/3K4/8/4NN2 w - - 0 1")), "KNNvK is not insufficient material");
+
+	const Endgame *white = ENDGAMES.probe(endgame_key("KRvKB")), *black = ENDGAMES.probe(mirror_key(endgame_key("KRvKB")));
+	check(i, white && black && white->type == ENDGAME_SCALE && black->type == ENDGAME_SCALE && white->strong == WHITE && black->strong == BLACK &&
+				 white->scale == black->scale,
+		  "KRvKB is in the endgame table for both colors");
+
+	Board kqk("8/8/3k4/8/8/8/8/2Q1K3 w - - 0 1"), kkq("2q1k3/8/8/8/8/3K4/8/8 b - - 0 1");
+	check(i, eval(kqk) >= VALUE_KNOWN_WIN && eval(kkq) == -eval(kqk), "KQvK is a known win for either color");
+	Board corner("7k/8/5K2/8/8/8/8/6Q1 w - - 0 1"), center("8/8/8/3k4/8/8/8/K5Q1 w - - 0 1");
+	check(i, eval(corner) > eval(center), "KQvK prefers the weak king in the corner");
+	Board kbbk("8/8/3k4/8/8/3K4/8/2B2B2 w - - 0 1"), same_color("8/8/3k4/8/8/3K4/8/2B1B3 w - - 0 1"), knnk("8/8/3k4/8/8/3K4/8/4NN2 w - - 0 1");
+	check(i, eval(kbbk) >= VALUE_KNOWN_WIN, "KBBvK with bishops of both colors is a known win");
+	check(i, eval(same_color) == 0, "KBBvK with bishops of one color is a draw");
+	check(i, eval(knnk) == 0, "KNNvK is scaled to a draw");
+
+	Board kbk("8/8/3k4/8/8/3K4/8/5B2 w - - 0 1");
+	std::pair<Move, Value> res = search_depth(kbk, 6, true);
+	check(i, res.second == 0, "KBvK searches to a draw");
+}
+
+#ifndef HCE
+// Drawish endings keep part of the network's score for their current output bucket
+void test_endgame_scaling(int &i) {
+	Board opposite("8/8/3k4/2b5/3P4/3B4/3K4/8 w - - 0 1"), krkb("8/8/3k4/2b5/8/8/3RK3/8 w - - 0 1");
+	int nbucket = 0; // Both have at most 5 pieces
+	check(i, eval(opposite) == debug_eval(opposite)[nbucket] * SCALE_OPPOSITE_BISHOPS / SCALE_NORMAL, "bishops of opposite colors are scaled");
+	const Endgame *endgame = ENDGAMES.probe(krkb.material_key);
+	check(i, endgame && eval(krkb) == debug_eval(krkb)[nbucket] * endgame->scale / SCALE_NORMAL, "KRvKB is scaled");
+}
+
+// Only the NNUE eval is cached
+void test_eval_cache(int &i) {
+	Board board(MIDGAME);
+	eval_cache.resize(0);
+	Value uncached = eval(board);
+	eval_cache.resize(DEFAULT_EVAL_CACHE_MB);
+	Value first = eval(board);
+	uint64_t hits = eval_cache.hits;
+	Value second = eval(board);
+	check(i, first == uncached && second == uncached && eval_cache.hits == hits + 1, "eval cache hit returns the uncached score");
+}
+
+void test_eval_batch(int &i) {
+	std::vector<std::string> fens = {STARTPOS, MIDGAME, "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+									 "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10"};
+	std::string in = "evalbatch_in.epd", out = "evalbatch_out.txt", error;
+	std::ofstream(in) << fens[0] << "\n" << fens[1] << " bm e2a6;\n\n" << fens[2] << "\n" << fens[3] << "\n";
+	bool ok = eval_batch(in, out, 2, error);
+	std::ifstream result(out);
+	for (const std::string &fen : fens) {
+		Board board(fen);
+		Value score;
+		ok &= result >> score && score == eval(board);
+	}
+	std::remove(in.c_str());
+	std::remove(out.c_str());
+	check(i, ok, "evalbatch writes the eval of every position");
+}
+
+void test_network_file(int &i) {
+	// The embedded network is a raw one, pack it and load it back as an EvalFile
+	Board board(MIDGAME);
+	Value embedded = eval(board);
+	std::string packed = "packed.nnue", error;
+	bool ok = pack_network_file(NNUE_PATH, packed, error) && load_network_file(packed, error);
+	board.reset_accumulators();
+	eval_cache.clear();
+	ok &= eval(board) == embedded;
+	std::remove(packed.c_str());
+	check(i, ok, "packed network loads with the same evaluation");
+
+	std::ofstream("truncated.nnue") << "not a network";
+	check(i, !load_network_file("truncated.nnue", error) && !error.empty(), "garbage network file is rejected");
+	std::remove("truncated.nnue");
+	load_embedded_network();
+	board.reset_accumulators();
+	eval_cache.clear();
+}
+#endif
+
 int main() {
 	int i = 1;
 	init_network();
 	for (auto [fen, depth, expected] : tests) {
+		clear_state();
 		Board board(fen);
 		std::pair<Move, Value> res = search(board, 3000);
 		if (expected[0] == '!') {
@@ -41,6 +218,30 @@ int main() {
 		}
 		i++;
 	}
+	clear_state();
+	test_repetition(i);
+	clear_state();
+	test_multipv(i);
+	clear_state();
+	test_endgames(i);
+#ifndef HCE
+	test_endgame_scaling(i);
+	test_eval_cache(i);
+	test_eval_batch(i);
+	test_network_file(i);
+#endif
+	for (auto [fen, moves, expected, length] : mate_tests) {
+		Board board(fen);
+		std::pair<Move, int> res = search_mate(board, moves, 16, true);
+		if (res.first.to_string() == expected && res.second == length) {
+			std::cout << "Passed test " << i << " - Got: " << res.first.to_string() << std::endl;
+		} else {
+			std::cout << "Failed test " << i << " - Got: " << res.first.to_string() << " in " << res.second << " - Expected: " << expected << " in "
+					  << length << std::endl;
+			failed = true;
+		}
+		i++;
+	}
 	return failed;
 }
 